@@ -6,6 +6,9 @@
 #ifndef MEOW__BUFFER_HPP_
 #define MEOW__BUFFER_HPP_
 
+#include <sys/types.h> // off_t
+#include <unistd.h>    // close
+
 #include <cstring> // memcpy
 #include <cstdlib> // malloc
 
@@ -21,6 +24,28 @@
 namespace meow {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+	// memory source for buffers that don't get it from malloc() directly, see meow/buffer_pool.hpp
+	//  sizes are in bytes
+	struct buffer_allocator_t
+	{
+		virtual void* reallocate(void *p, size_t old_sz, size_t new_sz) = 0;
+		virtual void  release(void *p, size_t sz) = 0;
+
+	protected:
+		~buffer_allocator_t() {}
+	};
+
+	// (fd, offset, length) piece of a file, sent after the memory part of the buffer that holds it
+	//  see meow/buffer_file_region.hpp
+	struct buffer_file_region_t
+	{
+		int    fd;
+		bool   owns_fd; // closed together with the buffer
+		bool   is_pipe; // spliced from, offset is not used
+		off_t  offset;  // next byte to send
+		size_t length;  // bytes left to send
+	};
+
 	template<class CharT>
 	struct buffer_impl_t : private boost::noncopyable
 	{
@@ -32,6 +57,12 @@ namespace meow {
 		char_t * begin_;
 		char_t * end_; // <-- past the end ptr
 
+		// NULL for plain malloc() memory
+		buffer_allocator_t *allocator_;
+
+		// NULL for memory-only buffers
+		buffer_file_region_t *region_;
+
 		static char_t* do_malloc(size_t const n_chars)
 		{
 			return (char_t*)malloc(n_chars * sizeof(char_t));
@@ -58,6 +89,8 @@ namespace meow {
 		buffer_impl_t(size_t sz)
 			: begin_(self_t::do_malloc(sz))
 			, end_(begin_ + sz)
+			, allocator_(NULL)
+			, region_(NULL)
 			, first(begin_)
 			, last(first)
 		{
@@ -68,6 +101,8 @@ namespace meow {
 		buffer_impl_t(char_t *b, size_t sz, size_t first_off = 0, size_t last_off = size_t(-1))
 			: begin_(b)
 			, end_(begin_ + sz)
+			, allocator_(NULL)
+			, region_(NULL)
 			, first(begin_ + first_off)
 			, last(begin_ + ((size_t(-1) == last_off) ? sz : last_off))
 		{
@@ -75,9 +110,43 @@ namespace meow {
 			invariant_check();
 		}
 
+		// takes ownership of b, which is given back to the allocator on destruction
+		buffer_impl_t(buffer_allocator_t *alloc, char_t *b, size_t sz)
+			: begin_(b)
+			, end_(begin_ + sz)
+			, allocator_(alloc)
+			, region_(NULL)
+			, first(begin_)
+			, last(first)
+		{
+			assert(NULL != begin_);
+			assert(NULL != allocator_);
+		}
+
+		// file region, no memory to start with, it's allocated by resize_to() if ever needed
+		explicit buffer_impl_t(buffer_file_region_t const& r)
+			: begin_(NULL)
+			, end_(NULL)
+			, allocator_(NULL)
+			, region_(new buffer_file_region_t(r))
+			, first(begin_)
+			, last(first)
+		{
+		}
+
 		~buffer_impl_t()
 		{
-			self_t::do_free(begin_);
+			if (NULL != region_)
+			{
+				if (region_->owns_fd)
+					::close(region_->fd);
+				delete region_;
+			}
+
+			if (NULL != allocator_)
+				allocator_->release(begin_, this->size() * sizeof(char_t));
+			else
+				self_t::do_free(begin_);
 		}
 
 	public:
@@ -94,7 +163,11 @@ namespace meow {
 		size_t free_size() const { return size_t(end_ - last); }
 
 		bool full() const { return (last == end_); }
-		bool empty() const { return (first == last); }
+
+		// nothing left, neither in memory nor in the file region
+		bool empty() const { return (first == last) && (NULL == region_ || 0 == region_->length); }
+
+		buffer_file_region_t* file_region() const { return region_; }
 
 		void clear() { first = last = begin_; invariant_check(); }
 
@@ -108,7 +181,9 @@ namespace meow {
 
 		void resize_to(size_t new_sz)
 		{
-			char_t *new_begin = self_t::do_realloc(this->begin_, new_sz);
+			char_t *new_begin = (NULL != allocator_)
+				? (char_t*)allocator_->reallocate(this->begin_, this->size() * sizeof(char_t), new_sz * sizeof(char_t))
+				: self_t::do_realloc(this->begin_, new_sz);
 			assert(NULL != new_begin);
 
 			this->first = new_begin + (this->first - this->begin_);
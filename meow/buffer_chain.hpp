@@ -19,7 +19,7 @@ namespace meow {
 		typedef buffer_t         value_t;
 		typedef buffer_move_ptr  value_move_ptr;
 
-		static bool const constant_time_size = false;
+		static bool const constant_time_size = true; // size() is cheap, write queues are checked often
 		static bool const linear = true;
 	};
 
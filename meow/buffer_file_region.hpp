@@ -0,0 +1,72 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW__BUFFER_FILE_REGION_HPP_
+#define MEOW__BUFFER_FILE_REGION_HPP_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <algorithm> // min
+
+#include <meow/buffer.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// a buffer that sends length bytes of fd from offset, goes to write chains with memory ones
+	//  connections send it with sendfile(), pipes with splice()
+	//  a pipe must already hold all the length bytes (i.e. filled with vmsplice() or tee()), as nobody waits for it
+	//
+	// the file is not read or checked here, it's an io error on write if it gets shorter than that
+	inline buffer_move_ptr buffer_create_with_file_region(int fd, off_t offset, size_t length, bool owns_fd = false)
+	{
+		struct stat st;
+		bool const is_pipe = (0 == ::fstat(fd, &st)) && S_ISFIFO(st.st_mode);
+
+		buffer_file_region_t const r = { fd, owns_fd, is_pipe, offset, length };
+		return buffer_move_ptr(new buffer_t(r));
+	}
+
+	// for writers that can only send memory (ssl, engines keeping buffers in flight)
+	//  reads up to max_sz bytes of the region into empty memory part of the buffer and moves the region forward
+	//  returns bytes read, 0 if the file ended early or -1 and errno
+	inline ssize_t buffer_file_region_fill(buffer_t& b, size_t max_sz)
+	{
+		buffer_file_region_t *r = b.file_region();
+		assert(NULL != r);
+		assert(0 == b.used_size());
+
+		size_t const sz = std::min(r->length, max_sz);
+		if (b.size() < sz)
+			b.resize_to(sz);
+		b.clear();
+
+		ssize_t n;
+		do {
+			n = (r->is_pipe)
+				? ::read(r->fd, b.last, sz)
+				: ::pread(r->fd, b.last, sz, r->offset)
+				;
+		} while (-1 == n && EINTR == errno);
+
+		if (n > 0)
+		{
+			b.advance_last(n);
+			r->offset += n;
+			r->length -= n;
+		}
+
+		return n;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW__BUFFER_FILE_REGION_HPP_
@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW__BUFFER_POOL_HPP_
+#define MEOW__BUFFER_POOL_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib> // malloc
+#include <cstring> // memcpy
+
+#include <algorithm> // min
+#include <new>       // bad_alloc
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/buffer.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct buffer_pool_stats_t
+	{
+		uint64_t hits;           // allocations served from free lists
+		uint64_t misses;         // allocations that went to malloc()
+		uint64_t releases;       // blocks put back to free lists
+		uint64_t drops;          // blocks freed on release: too large, over the retain limit or released by other thread
+		size_t   bytes_retained; // sitting in free lists right now
+	};
+
+	// power-of-two size classes, from 64 bytes to 1mb, larger requests are plain malloc()
+	//  free lists are threaded through the free blocks themselves
+	//
+	// no locking, the pool belongs to the thread that created it (i.e. to the event loop running there)
+	//  buffers released by other threads are just free()d, so passing them around is fine
+	//  those are the only thing other threads touch, counted separately in an atomic
+	//  a pool must outlive buffers made from it, this_thread() pool takes care of that itself
+	struct buffer_pool_t : public buffer_allocator_t, private boost::noncopyable
+	{
+		static size_t const min_class_shift = 6;
+		static size_t const max_class_shift = 20;
+		static size_t const n_classes       = max_class_shift - min_class_shift + 1;
+
+	private:
+
+		struct free_node_t
+		{
+			free_node_t *next;
+		};
+
+		free_node_t                *free_[n_classes];
+		size_t                      max_bytes_retained_;
+		std::atomic<void const*>    owner_;
+		buffer_pool_stats_t         stats_;
+		std::atomic<uint64_t>       foreign_drops_; // released by other threads
+
+	public:
+
+		explicit buffer_pool_t(size_t max_bytes_retained = 32 * 1024 * 1024)
+			: max_bytes_retained_(max_bytes_retained)
+			, owner_(self_thread_tag())
+			, foreign_drops_(0)
+		{
+			std::fill(free_, free_ + n_classes, (free_node_t*)NULL);
+			std::memset(&stats_, 0, sizeof(stats_));
+		}
+
+		~buffer_pool_t()
+		{
+			this->trim();
+		}
+
+		buffer_pool_stats_t stats() const
+		{
+			buffer_pool_stats_t result = stats_;
+			result.drops += foreign_drops_.load(std::memory_order_relaxed);
+			return result;
+		}
+
+		// the pool of calling thread, created on first use
+		//  it's never deleted, as buffers might be still alive at thread exit
+		//  just emptied and detached from the thread, so that those are free()d
+		static buffer_pool_t* this_thread()
+		{
+			struct holder_t
+			{
+				buffer_pool_t *pool;
+
+				holder_t() : pool(new buffer_pool_t) {}
+				~holder_t() { pool->detach(); }
+			};
+
+			static thread_local holder_t h;
+			return h.pool;
+		}
+
+	public:
+
+		static size_t class_index(size_t sz)
+		{
+			if (sz <= (size_t(1) << min_class_shift))
+				return 0;
+
+			size_t const shift = sizeof(unsigned long) * 8 - __builtin_clzl(sz - 1);
+			return (shift > max_class_shift)
+					? n_classes
+					: shift - min_class_shift
+					;
+		}
+
+		static size_t class_size(size_t idx)
+		{
+			return size_t(1) << (idx + min_class_shift);
+		}
+
+		// memory block of at least sz bytes or NULL
+		void* allocate(size_t sz)
+		{
+			size_t const idx = class_index(sz);
+			if (idx >= n_classes)
+			{
+				stats_.misses++;
+				return ::malloc(sz);
+			}
+
+			free_node_t *n = free_[idx];
+			if (NULL == n)
+			{
+				stats_.misses++;
+				return ::malloc(class_size(idx));
+			}
+
+			free_[idx] = n->next;
+			stats_.bytes_retained -= class_size(idx);
+			stats_.hits++;
+			return n;
+		}
+
+		// sz must be the same as given to allocate()
+		virtual void release(void *p, size_t sz)
+		{
+			size_t const idx = class_index(sz);
+
+			if (!this->is_owner_thread())
+			{
+				foreign_drops_.fetch_add(1, std::memory_order_relaxed);
+				::free(p);
+				return;
+			}
+
+			if ((idx >= n_classes) || (stats_.bytes_retained + class_size(idx) > max_bytes_retained_))
+			{
+				stats_.drops++;
+				::free(p);
+				return;
+			}
+
+			free_node_t *n = (free_node_t*)p;
+			n->next = free_[idx];
+			free_[idx] = n;
+
+			stats_.bytes_retained += class_size(idx);
+			stats_.releases++;
+		}
+
+		virtual void* reallocate(void *p, size_t old_sz, size_t new_sz)
+		{
+			size_t const old_idx = class_index(old_sz);
+			size_t const new_idx = class_index(new_sz);
+
+			// same class, the block is large enough already
+			if (old_idx == new_idx)
+				return (old_idx < n_classes) ? p : ::realloc(p, new_sz);
+
+			// keep the block class-sized, so that it can go to free list on the owner thread later
+			if (!this->is_owner_thread())
+				return ::realloc(p, (new_idx < n_classes) ? class_size(new_idx) : new_sz);
+
+			void *r = this->allocate(new_sz);
+			if (NULL == r)
+				return NULL;
+
+			std::memcpy(r, p, std::min(old_sz, new_sz));
+			this->release(p, old_sz);
+			return r;
+		}
+
+		// give all retained memory back to the system
+		void trim()
+		{
+			for (size_t i = 0; i < n_classes; ++i)
+			{
+				while (free_node_t *n = free_[i])
+				{
+					free_[i] = n->next;
+					::free(n);
+				}
+			}
+			stats_.bytes_retained = 0;
+		}
+
+	private:
+
+		void detach()
+		{
+			this->trim();
+			owner_.store(NULL, std::memory_order_relaxed);
+		}
+
+		bool is_owner_thread() const
+		{
+			return owner_.load(std::memory_order_relaxed) == self_thread_tag();
+		}
+
+		static void const* self_thread_tag()
+		{
+			static thread_local char tag;
+			return &tag;
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline buffer_move_ptr create_buffer_from_pool(buffer_pool_t *pool, size_t sz)
+	{
+		char *p = (char*)pool->allocate(sz);
+		if (NULL == p)
+			throw std::bad_alloc();
+
+		return buffer_move_ptr(new buffer_t(pool, p, sz));
+	}
+
+	inline buffer_move_ptr create_buffer_from_pool(size_t sz)
+	{
+		return create_buffer_from_pool(buffer_pool_t::this_thread(), sz);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW__BUFFER_POOL_HPP_
@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW__BUFFER_SHARED_HPP_
+#define MEOW__BUFFER_SHARED_HPP_
+
+#include <cassert>
+#include <stdexcept> // logic_error
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/buffer.hpp>
+#include <meow/intrusive_ptr.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// immutable data, queued to any number of write chains (connections) without copying
+	//  each view() is a regular buffer_t over the same memory, with first/last of its own (i.e. write offset)
+	//  the data is freed when the last view and the last shared_buffer_ptr are gone
+	//
+	// the counter is atomic, views can be sent from different threads (loops)
+	// views have no free space, so nothing is ever appended to them (i.e. by write coalescing)
+	//  and they can't be resized
+	struct shared_buffer_t
+		: public buffer_allocator_t
+		, public boost::intrusive_ref_counter<shared_buffer_t>
+		, private boost::noncopyable
+	{
+		// takes over the used part of b (the whole buffer is kept and freed to wherever it came from)
+		explicit shared_buffer_t(buffer_move_ptr b)
+			: buf_(move(b))
+		{
+			assert(NULL == buf_->file_region());
+		}
+
+		str_ref data() const { return buf_->used_part(); }
+		size_t  size() const { return buf_->used_size(); }
+
+		// a new buffer to queue, holds a reference till it's deleted
+		buffer_move_ptr view()
+		{
+			intrusive_ptr_add_ref(this);
+
+			buffer_move_ptr b(new buffer_t(this, buf_->first, buf_->used_size()));
+			b->advance_last(buf_->used_size());
+			return b;
+		}
+
+	private: // buffer_allocator_t, for the views
+
+		virtual void* reallocate(void*, size_t, size_t) override
+		{
+			throw std::logic_error("shared_buffer_t: views are immutable");
+		}
+
+		virtual void release(void*, size_t) override
+		{
+			intrusive_ptr_release(this);
+		}
+
+	private:
+		buffer_move_ptr buf_;
+	};
+
+	typedef boost::intrusive_ptr<shared_buffer_t> shared_buffer_ptr;
+
+	inline shared_buffer_ptr shared_buffer_create(buffer_move_ptr b)
+	{
+		return make_intrusive<shared_buffer_t>(move(b));
+	}
+
+	inline shared_buffer_ptr shared_buffer_create_with_data(void const *data, size_t data_len)
+	{
+		return shared_buffer_create(buffer_create_with_data(data, data_len));
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW__BUFFER_SHARED_HPP_
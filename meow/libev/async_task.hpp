@@ -3,18 +3,30 @@
 // (c) Anton Povarov <anton.povarov@gmail.com>
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+#ifndef MEOW_LIBEV__ASYNC_TASK_HPP_
+#define MEOW_LIBEV__ASYNC_TASK_HPP_
+
 #include <cstdint>
+#include <algorithm>
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <functional>
+#include <future>
 #include <utility>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
+#include <meow/intrusive_ptr.hpp>
 #include <meow/std_unique_ptr.hpp>
 #include <meow/ptr_list.hpp>
+#include <meow/thread_placement.hpp>
 #include <meow/unique_id.hpp>
 #include <meow/utility/offsetof.hpp>
+#include <meow/unix/time.hpp>
+
+#include <meow/libev/libev.hpp>
 
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -47,6 +59,46 @@ namespace meow { namespace libev {
 
 		virtual void run_task(async_task_ptr) = 0;      // main thread only
 		virtual void finalize_task(async_task_t*) = 0;  // worker thread only
+
+		// tasks that were not run, as they were past deadline or cancelled by the time a worker got to them
+		uint64_t tasks_expired() const   { return n_expired_.load(std::memory_order_relaxed); }
+		uint64_t tasks_cancelled() const { return n_cancelled_.load(std::memory_order_relaxed); }
+
+	protected:
+
+		// worker thread, task must be in the running queue already
+		//  expired and cancelled tasks are finalized right away, to get task_finished() on the main loop as usual
+		//  returns true if the task was run
+		inline bool run_or_skip_task(async_task_t *task, evloop_t *loop);
+
+	private:
+		std::atomic<uint64_t> n_expired_   { 0 };
+		std::atomic<uint64_t> n_cancelled_ { 0 };
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// cooperative cancellation, a task has one and the same token can be given to several tasks
+	//  cancel() from any thread, i.e. the main loop when the client is gone
+	//  executors check it before running a task, the running task checks it whenever convenient
+	struct async_cancel_token_t
+	{
+		async_cancel_token_t()
+			: state_(make_intrusive<state_t>())
+		{
+		}
+
+		void cancel() const          { state_->is_cancelled.store(true, std::memory_order_relaxed); }
+		bool is_cancelled() const    { return state_->is_cancelled.load(std::memory_order_relaxed); }
+
+	private:
+
+		struct state_t : public boost::intrusive_ref_counter<state_t>
+		{
+			std::atomic<bool> is_cancelled { false };
+		};
+
+		boost::intrusive_ptr<state_t> state_;
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -55,10 +107,29 @@ namespace meow { namespace libev {
 	{
 		uint64_t const   unique_id;
 
+		// latency tasks are taken from executor queues before any batch ones
+		enum priority_t
+		{
+			  priority_latency = 0
+			, priority_batch
+			, priority_count
+		};
+
+		// for do_finished(), if the task ran or was skipped
+		enum status_t
+		{
+			  status_run = 0
+			, status_expired
+			, status_cancelled
+		};
+
 	public:
 
 		async_task_t()
 			: unique_id(meow::unique_id<struct tag>::generate_unique_id())
+			, priority_(priority_latency)
+			, status_(status_run)
+			, deadline_({ 0, 0 })
 		{
 		}
 
@@ -67,6 +138,37 @@ namespace meow { namespace libev {
 		evloop_t*    loop() const { return loop_; }
 		async_env_t* env()  const { return executor_->task_env(); }
 
+		status_t     status() const { return status_; }
+
+	public: // main thread, set before run_task()
+
+		priority_t priority() const           { return priority_; }
+		void       set_priority(priority_t p) { priority_ = p; }
+
+		// monotonic clock (os_unix::clock_monotonic_now()), zero = none
+		timeval_t  deadline() const                    { return deadline_; }
+		void       set_deadline(timeval_t const& tv)   { deadline_ = tv; }
+		void       set_timeout(duration_t const& d)    { deadline_ = os_unix::clock_monotonic_now() + d; }
+
+		async_cancel_token_t const& cancel_token() const                   { return cancel_token_; }
+		void                        set_cancel_token(async_cancel_token_t t) { cancel_token_ = std::move(t); }
+
+	public: // any thread
+
+		void cancel()             { cancel_token_.cancel(); }
+		bool is_cancelled() const { return cancel_token_.is_cancelled(); }
+
+		// true when the task is to be skipped, status is set then
+		bool task_check_skip() // worker thread
+		{
+			if (this->is_cancelled())
+				status_ = status_cancelled;
+			else if ((0 != deadline_.tv_sec || 0 != deadline_.tv_nsec) && deadline_ <= os_unix::clock_monotonic_now())
+				status_ = status_expired;
+
+			return (status_run != status_);
+		}
+
 	public:
 
 		void task_run(async_executor_t *e, evloop_t *loop) // worker thread
@@ -101,10 +203,32 @@ namespace meow { namespace libev {
 		virtual void do_finished() = 0;
 
 	private:
-		evloop_t         *loop_;
-		async_executor_t *executor_;
+		evloop_t             *loop_;
+		async_executor_t     *executor_;
+
+		priority_t            priority_;
+		status_t              status_;
+		timeval_t             deadline_;
+		async_cancel_token_t  cancel_token_;
 	};
 
+	inline bool async_executor_t::run_or_skip_task(async_task_t *task, evloop_t *loop)
+	{
+		if (!task->task_check_skip())
+		{
+			task->task_run(this, loop);
+			return true;
+		}
+
+		if (async_task_t::status_expired == task->status())
+			n_expired_.fetch_add(1, std::memory_order_relaxed);
+		else
+			n_cancelled_.fetch_add(1, std::memory_order_relaxed);
+
+		this->finalize_task(task);
+		return false;
+	}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 	struct async_executor___threaded_t : public async_executor_t
@@ -112,6 +236,8 @@ namespace meow { namespace libev {
 		using self_t  = async_executor___threaded_t;
 		using queue_t = meow::ptr_list_t<async_task_t>;
 
+		using async_executor_t::startup;
+
 		virtual async_env_t* task_env() const override
 		{
 			return thr_ctx_->task_env.get();
@@ -124,7 +250,11 @@ namespace meow { namespace libev {
 				if (this->shutting_down != 0)
 					return;
 
-				thr_ctx_->incoming_q.push_back(move(task));
+				async_task_t::priority_t const prio = task->priority();
+				if (async_task_t::priority_latency == prio)
+					thr_ctx_->has_latency_tasks.store(true, std::memory_order_relaxed);
+
+				thr_ctx_->incoming_q[prio].push_back(move(task));
 			}
 
 			this->thread_notify();
@@ -144,8 +274,9 @@ namespace meow { namespace libev {
 
 	public:
 
-		async_executor___threaded_t(evloop_t *loop)
-			: loop_(loop)
+		async_executor___threaded_t(evloop_t *loop, thread_placement_ptr placement = {})
+			: placement_(move(placement))
+			, loop_(loop)
 			, shutting_down(0)
 		{
 			ev_async_init(&ev_, &executor_wakeup);
@@ -175,11 +306,9 @@ namespace meow { namespace libev {
 			thr_ctx_ = [&]()
 			{
 				auto ctx = meow::make_unique<thread_ctx_t>();
-				ctx->loop = libev::create_loop(EVFLAG_AUTO | EVFLAG_NOENV);
 
 				ctx->ev.data = this;
 				ev_async_init(&ctx->ev, &thr_wakeup);
-				ev_async_start(ctx->loop.get(), &ctx->ev);
 
 				return move(ctx);
 			}();
@@ -189,14 +318,30 @@ namespace meow { namespace libev {
 
 			std::atomic_thread_fence(std::memory_order_seq_cst); // make sure everything is constructed before thread starts
 
-			thr_ = meow::make_unique<std::thread>([ctx, task_env_init_func]
+			thread_placement_ptr placement = placement_;
+			size_t const slot = thread_placement_next_slot(placement);
+
+			auto loop_ready = std::make_shared<std::promise<void>>();
+			std::future<void> loop_ready_f = loop_ready->get_future();
+
+			thr_ = meow::make_unique<std::thread>([ctx, task_env_init_func, placement, slot, loop_ready]
 			{
+				// loop and task env are created after pinning, to get memory local to where the thread is going to run
+				thread_placement_apply(placement, slot);
+
+				ctx->loop = libev::create_loop(EVFLAG_AUTO | EVFLAG_NOENV);
+				ev_async_start(ctx->loop.get(), &ctx->ev);
+				loop_ready->set_value();
+
 				ctx->task_env = task_env_init_func(ctx->loop.get());
 
 				std::atomic_thread_fence(std::memory_order_seq_cst); // make sure ctx->task_env write is visible to event loop
 
 				libev::run_loop(ctx->loop);
 			});
+
+			// tasks can be sent to the thread from now on
+			loop_ready_f.wait();
 		}
 
 	private:
@@ -207,7 +352,7 @@ namespace meow { namespace libev {
 			auto *ctx = MEOW_SELF_FROM_MEMBER(thread_ctx_t, ev, ev);
 
 			bool shutting_down;
-			queue_t local_q;
+			queue_t local_q[async_task_t::priority_count];
 			{ // grab everything from incoming queue to local queue to reduce locking
 				std::lock_guard<std::mutex> lk_(ctx->incoming_mtx);
 				shutting_down = executor->shutting_down;
@@ -215,7 +360,12 @@ namespace meow { namespace libev {
 				// in case of shutdown - we want queued (but not processed) tasks to be destroyed in main thread
 				// so don't touch ctx->incoming_q here
 				if (!shutting_down)
-					local_q.swap(ctx->incoming_q);
+				{
+					for (size_t i = 0; i < async_task_t::priority_count; ++i)
+						local_q[i].swap(ctx->incoming_q[i]);
+
+					ctx->has_latency_tasks.store(false, std::memory_order_relaxed);
+				}
 			}
 
 			if (shutting_down)
@@ -233,11 +383,30 @@ namespace meow { namespace libev {
 				return;
 			}
 
-			while (!local_q.empty())
+			for (size_t i = 0; i < async_task_t::priority_count; ++i)
 			{
-				async_task_ptr task = local_q.grab_front();
-				async_task_t *task_p = ctx->running_q.push_back(move(task));
-				task_p->task_run(executor, loop);
+				while (!local_q[i].empty())
+				{
+					// latency tasks came in while running the lower priority ones
+					//  put the rest back in front of the queue, and come back for all of them
+					if (i > async_task_t::priority_latency && ctx->has_latency_tasks.load(std::memory_order_relaxed))
+					{
+						std::lock_guard<std::mutex> lk_(ctx->incoming_mtx);
+
+						for (size_t j = i; j < async_task_t::priority_count; ++j)
+						{
+							local_q[j].append_chain(ctx->incoming_q[j]);
+							local_q[j].swap(ctx->incoming_q[j]);
+						}
+
+						ev_async_send(loop, ev);
+						return;
+					}
+
+					async_task_ptr task = local_q[i].grab_front();
+					async_task_t *task_p = ctx->running_q.push_back(move(task));
+					executor->run_or_skip_task(task_p, loop);
+				}
 			}
 		}
 
@@ -276,13 +445,16 @@ namespace meow { namespace libev {
 			evasync_t        ev;
 			async_env_ptr    task_env;
 			std::mutex       incoming_mtx;
-			queue_t          incoming_q;
+			queue_t          incoming_q[async_task_t::priority_count];
 			queue_t          running_q;
+
+			std::atomic<bool> has_latency_tasks { false };
 		};
 
 	private:
 		std::unique_ptr<std::thread>   thr_;
 		std::unique_ptr<thread_ctx_t>  thr_ctx_;
+		thread_placement_ptr           placement_;
 
 		evloop_t   *loop_;
 		evasync_t   ev_;
@@ -322,6 +494,366 @@ namespace meow { namespace libev {
 
 	typedef std::unique_ptr<async_scheduler___round_robin_t> async_scheduler_ptr;
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// per worker, a snapshot
+	struct async_worker_stats_t
+	{
+		size_t   queue_depth; // queued, not running yet
+		size_t   running;     // task_run() done, task_finalize() not yet
+		uint64_t tasks_run;
+		uint64_t steals;      // tasks this worker took from the other queues
+	};
+
+	// n worker threads, each with its own loop, task env and queue
+	//  run_task() puts tasks to worker queues in turn
+	//  a worker takes the tasks from its queue one at a time, and when it's empty - from the other queues
+	//  so tasks queued behind a slow one are picked up by the workers that are free
+	//  latency tasks are taken (and stolen) before any batch ones
+	//
+	// task lifecycle is the same as with async_executor___threaded_t
+	//  task_run() and task_finalize() on the worker thread (the one that took the task)
+	//  task_abort() on that thread at shutdown, task_finished() on the main loop
+	// task_env() is the env of the calling worker thread
+	struct async_executor___work_stealing_t : public async_executor_t
+	{
+		using self_t  = async_executor___work_stealing_t;
+		using queue_t = meow::ptr_list_t<async_task_t>;
+
+		// tasks run per loop wakeup, the loop is let to do the io for the running ones in between
+		static size_t const run_batch_size = 64;
+
+		using async_executor_t::startup;
+
+		virtual async_env_t* task_env() const override
+		{
+			assert(NULL != current_worker() && "worker threads only");
+			return current_worker()->task_env.get();
+		}
+
+		virtual void run_task(async_task_ptr task) override
+		{
+			worker_t *w = workers_[next_worker_].get();
+			if (++next_worker_ >= workers_.size())
+				next_worker_ = 0;
+
+			{
+				std::lock_guard<std::mutex> g_(w->incoming_mtx);
+				if (this->shutting_down.load())
+					return;
+
+				async_task_t::priority_t const prio = task->priority();
+				w->incoming_q[prio].push_back(move(task));
+				w->queue_depth.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			this->worker_notify(w);
+
+			// it's stuck in a task, let somebody else pick it up
+			if (w->is_busy.load(std::memory_order_relaxed))
+				this->notify_idle_worker(w);
+		}
+
+		virtual void finalize_task(async_task_t *task_p) override
+		{
+			worker_t *w = current_worker();
+			assert(NULL != w && "worker threads only");
+
+			async_task_ptr task = w->running_q.grab_by_ptr(task_p);
+			w->running.fetch_sub(1, std::memory_order_relaxed);
+
+			{
+				std::lock_guard<std::mutex> g_(this->results_mtx);
+				this->results_q.push_back(move(task));
+			}
+
+			this->executor_notify();
+		}
+
+	public:
+
+		async_executor___work_stealing_t(evloop_t *loop, size_t n_workers = std::thread::hardware_concurrency(), thread_placement_ptr placement = {})
+			: next_worker_(0)
+			, placement_(move(placement))
+			, loop_(loop)
+			, shutting_down(false)
+		{
+			for (size_t i = 0; i < std::max(n_workers, (size_t)1); ++i)
+				workers_.push_back(meow::make_unique<worker_t>(this));
+
+			ev_async_init(&ev_, &executor_wakeup);
+			ev_async_start(loop_, &ev_);
+		}
+
+		~async_executor___work_stealing_t()
+		{
+			this->shutting_down.store(true);
+
+			for (auto& w : workers_)
+			{
+				if (w->thr)
+				{
+					this->worker_notify(w.get());
+					w->thr->join();
+				}
+			}
+
+			ev_async_stop(loop_, &ev_);
+		}
+
+		virtual void startup(std::function<async_env_ptr(evloop_t*)> const& task_env_init_func) override
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst); // make sure everything is constructed before threads start
+
+			// workers notify each other, so none starts taking tasks before all the loops are there
+			auto all_ready = std::make_shared<std::promise<void>>();
+			std::shared_future<void> all_ready_f = all_ready->get_future().share();
+
+			std::vector<std::future<void>> loops_ready;
+
+			for (auto& w_ptr : workers_)
+			{
+				worker_t *w = w_ptr.get();
+				thread_placement_ptr placement = placement_;
+				size_t const slot = thread_placement_next_slot(placement);
+
+				auto loop_ready = std::make_shared<std::promise<void>>();
+				loops_ready.push_back(loop_ready->get_future());
+
+				w->thr = meow::make_unique<std::thread>([w, task_env_init_func, placement, slot, loop_ready, all_ready_f]
+				{
+					// loop and task env are created after pinning, to get memory local to where the thread is going to run
+					thread_placement_apply(placement, slot);
+
+					w->loop = libev::create_loop(EVFLAG_AUTO | EVFLAG_NOENV);
+					ev_async_start(w->loop.get(), &w->ev);
+					loop_ready->set_value();
+
+					all_ready_f.wait();
+
+					current_worker() = w;
+					w->task_env = task_env_init_func(w->loop.get());
+
+					std::atomic_thread_fence(std::memory_order_seq_cst); // make sure w->task_env write is visible to event loop
+
+					// tasks might have been scheduled before startup()
+					ev_async_send(w->loop.get(), &w->ev);
+
+					libev::run_loop(w->loop);
+				});
+			}
+
+			for (auto& f : loops_ready)
+				f.wait();
+
+			all_ready->set_value();
+		}
+
+		std::vector<async_worker_stats_t> stats() const
+		{
+			std::vector<async_worker_stats_t> result;
+			for (auto const& w : workers_)
+			{
+				async_worker_stats_t s;
+				s.queue_depth = w->queue_depth.load(std::memory_order_relaxed);
+				s.running     = w->running.load(std::memory_order_relaxed);
+				s.tasks_run   = w->tasks_run.load(std::memory_order_relaxed);
+				s.steals      = w->steals.load(std::memory_order_relaxed);
+				result.push_back(s);
+			}
+			return result;
+		}
+
+	private:
+
+		struct worker_t : private boost::noncopyable
+		{
+			self_t                      *executor;
+			evloop_dynamic_t             loop;
+			evasync_t                    ev;
+			async_env_ptr                task_env;
+			std::unique_ptr<std::thread> thr;
+
+			std::mutex                   incoming_mtx;
+			queue_t                      incoming_q[async_task_t::priority_count];
+			queue_t                      running_q; // worker thread only
+
+			std::atomic<bool>            is_busy { false };
+			std::atomic<size_t>          queue_depth { 0 };
+			std::atomic<size_t>          running { 0 };
+			std::atomic<uint64_t>        tasks_run { 0 };
+			std::atomic<uint64_t>        steals { 0 };
+
+			// loop is created by the thread, see startup()
+			explicit worker_t(self_t *e)
+				: executor(e)
+			{
+				ev_async_init(&ev, &worker_wakeup);
+			}
+		};
+
+		static worker_t*& current_worker()
+		{
+			static thread_local worker_t *w = NULL;
+			return w;
+		}
+
+		// NULL if shutting down or there is nothing of this priority
+		async_task_ptr grab_task(worker_t *w, size_t prio, bool *shutting_down)
+		{
+			std::lock_guard<std::mutex> g_(w->incoming_mtx);
+
+			// in case of shutdown - we want queued (but not processed) tasks to be destroyed in main thread
+			*shutting_down = this->shutting_down.load();
+			if (*shutting_down || w->incoming_q[prio].empty())
+				return async_task_ptr();
+
+			w->queue_depth.fetch_sub(1, std::memory_order_relaxed);
+			return w->incoming_q[prio].grab_front();
+		}
+
+		// the oldest task of this priority from somebody else's queue, starting with the next worker
+		async_task_ptr steal_task(worker_t *thief, size_t prio)
+		{
+			size_t const n = workers_.size();
+			size_t self_idx = 0;
+			while (workers_[self_idx].get() != thief)
+				++self_idx;
+
+			for (size_t i = 1; i < n; ++i)
+			{
+				worker_t *victim = workers_[(self_idx + i) % n].get();
+				if (0 == victim->queue_depth.load(std::memory_order_relaxed))
+					continue;
+
+				bool shutting_down;
+				async_task_ptr task = this->grab_task(victim, prio, &shutting_down);
+				if (task)
+				{
+					thief->steals.fetch_add(1, std::memory_order_relaxed);
+					return task;
+				}
+
+				if (shutting_down)
+					break;
+			}
+
+			return async_task_ptr();
+		}
+
+		static void worker_wakeup(evloop_t *loop, evasync_t *ev, int revents)
+		{
+			worker_t *w = MEOW_SELF_FROM_MEMBER(worker_t, ev, ev);
+			self_t *executor = w->executor;
+
+			w->is_busy.store(true, std::memory_order_relaxed);
+
+			for (size_t n_run = 0; n_run < run_batch_size; ++n_run)
+			{
+				// own latency, anybody's latency, own batch, anybody's batch
+				bool shutting_down = false;
+				async_task_ptr task;
+				for (size_t prio = 0; !task && !shutting_down && prio < async_task_t::priority_count; ++prio)
+				{
+					task = executor->grab_task(w, prio, &shutting_down);
+					if (!task && !shutting_down)
+						task = executor->steal_task(w, prio);
+				}
+
+				if (shutting_down)
+				{
+					// cancel all executing tasks
+					while (!w->running_q.empty())
+					{
+						async_task_ptr t = w->running_q.grab_front();
+						w->running.fetch_sub(1, std::memory_order_relaxed);
+						t->task_abort();
+					}
+
+					libev::break_loop(w->loop, EVUNLOOP_ALL);
+					return;
+				}
+
+				if (!task)
+				{
+					w->is_busy.store(false, std::memory_order_relaxed);
+					return;
+				}
+
+				// more is waiting here, while this one runs
+				if (w->queue_depth.load(std::memory_order_relaxed) > 0)
+					executor->notify_idle_worker(w);
+
+				w->running.fetch_add(1, std::memory_order_relaxed);
+
+				async_task_t *task_p = w->running_q.push_back(move(task));
+				if (executor->run_or_skip_task(task_p, loop))
+					w->tasks_run.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			// batch is over, come back after the loop has done its io
+			w->is_busy.store(false, std::memory_order_relaxed);
+			ev_async_send(loop, ev);
+		}
+
+		static void executor_wakeup(evloop_t *loop, evasync_t *ev, int revents)
+		{
+			auto *executor = MEOW_SELF_FROM_MEMBER(self_t, ev_, ev);
+
+			queue_t local_q;
+			{
+				std::lock_guard<std::mutex> g_(executor->results_mtx);
+				local_q.swap(executor->results_q);
+			}
+
+			while (!local_q.empty())
+			{
+				async_task_ptr task = local_q.grab_front();
+				task->task_finished(loop);
+			}
+		}
+
+		void notify_idle_worker(worker_t *busy_w)
+		{
+			for (auto& w : workers_)
+			{
+				if (w.get() != busy_w && !w->is_busy.load(std::memory_order_relaxed))
+				{
+					this->worker_notify(w.get());
+					return;
+				}
+			}
+		}
+
+		void worker_notify(worker_t *w)
+		{
+			// not started yet, the thread checks its queue first thing
+			if (!w->loop)
+				return;
+
+			ev_async_send(w->loop.get(), &w->ev);
+		}
+
+		void executor_notify()
+		{
+			ev_async_send(loop_, &ev_);
+		}
+
+	private:
+		std::vector<std::unique_ptr<worker_t>> workers_;
+		size_t                                 next_worker_; // main thread only
+		thread_placement_ptr                   placement_;
+
+		evloop_t   *loop_;
+		evasync_t   ev_;
+		std::mutex  results_mtx;
+		queue_t     results_q;
+
+		std::atomic<bool> shutting_down;
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace meow { namespace libev {
 ////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__ASYNC_TASK_HPP_
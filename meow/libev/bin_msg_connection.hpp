@@ -24,7 +24,24 @@ namespace meow { namespace libev {
 			// return -1 from this function if header is bad and you've aborted the connection
 			virtual ssize_t on_header(bin_msg_connection_t*, str_ref const& headers_data) = 0;
 			virtual void on_message(bin_msg_connection_t*, buffer_move_ptr) = 0;
+
+			// read-ahead mode (option_bin_msg_read_ahead), complete messages (header + body) from a single read
+			//  views into the read buffer, valid during this call only
+			//  the default copies each one to a buffer of its own and calls on_message()
+			virtual void on_messages(bin_msg_connection_t *c, str_ref const *msgs, size_t n_msgs)
+			{
+				for (size_t i = 0; i < n_msgs && !c->is_closing(); ++i)
+				{
+					buffer_move_ptr b = create_buffer(msgs[i].size());
+					copy_to_buffer(*b, msgs[i].data(), msgs[i].size());
+					this->on_message(c, move(b));
+				}
+			}
 			virtual void on_closed(bin_msg_connection_t*, io_close_report_t const&) = 0;
+
+			// write queue backpressure, see option_write_high_watermark
+			virtual void on_write_blocked(bin_msg_connection_t*) {}
+			virtual void on_write_drained(bin_msg_connection_t*) {}
 		};
 	};
 
@@ -6,6 +6,8 @@
 #ifndef MEOW_LIBEV__BIN_MSG_CONNECTION_IMPL_HPP_
 #define MEOW_LIBEV__BIN_MSG_CONNECTION_IMPL_HPP_
 
+#include <cstring> // memmove
+
 #include <meow/smart_enum.hpp>
 #include <meow/utility/nested_name_alias.hpp>
 
@@ -24,6 +26,12 @@ namespace meow { namespace libev {
 		{
 			static size_t const header_size = /* implementation-defined */;
 		};
+
+		// read-ahead mode, reads up to this many bytes at once and slices all the complete messages out
+		//  they're delivered to on_messages() as views into the read buffer, without copying
+		//  only a trailing partial message is moved to the buffer start for the next read
+		//  default: 0, a message per buffer, delivered to on_message()
+		struct option_bin_msg_read_ahead { enum { value = 64 * 1024 }; };
 	};
 #endif
 
@@ -39,13 +47,26 @@ namespace meow { namespace libev {
 		struct read
 		{
 			typedef typename Traits::bin_msg_read tr;
+			typedef generic_connection_buffer_traits<Traits> tr_buffers;
 			typedef bin_msg_read_state            read_state;
 			typedef bin_msg_read_state_t          read_state_t;
 
+			struct option_bin_msg_read_ahead_default { enum { value = 0 }; };
+			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_bin_msg_read_ahead, option_bin_msg_read_ahead_default);
+
+			enum
+			{
+				read_ahead       = option_bin_msg_read_ahead::value,
+				read_ahead_batch = 64, // messages per on_messages() call, at most
+			};
+
+			static_assert(0 == read_ahead || read_ahead >= tr::header_size, "option_bin_msg_read_ahead must fit a header");
+
 			struct context_t
 			{
 				read_state_t 	r_state;
 				buffer_move_ptr r_buf;
+				size_t          r_msg_len; // read-ahead: header + body of the message at buffer start, when r_state == body
 
 				context_t()
 				{
@@ -56,6 +77,7 @@ namespace meow { namespace libev {
 				{
 					r_state = read_state::header;
 					r_buf.reset();
+					r_msg_len = 0;
 				}
 			};
 
@@ -64,11 +86,14 @@ namespace meow { namespace libev {
 			template<class ConnectionT>
 			static buffer_ref get_buffer(ConnectionT *c)
 			{
+				if (read_ahead)
+					return get_buffer_read_ahead(c);
+
 				context_t *ctx = c;
 				buffer_move_ptr& b = ctx->r_buf;
 
 				if (!b)
-					b.reset(new buffer_t(tr::header_size));
+					b = tr_buffers::create_read_buffer(tr::header_size);
 
 				switch (ctx->r_state)
 				{
@@ -101,6 +126,9 @@ namespace meow { namespace libev {
 					return rd_consume_status::closed;
 				}
 
+				if (read_ahead)
+					return consume_buffer_read_ahead(c, read_part);
+
 				buffer_move_ptr& b = ctx->r_buf;
 				b->advance_last(read_part.size());
 
@@ -137,6 +165,100 @@ namespace meow { namespace libev {
 						break;
 				}
 
+				return rd_consume_status::more;
+			}
+
+		private: // read-ahead mode
+
+			template<class ConnectionT>
+			static buffer_ref get_buffer_read_ahead(ConnectionT *c)
+			{
+				context_t *ctx = c;
+				buffer_move_ptr& b = ctx->r_buf;
+
+				if (!b)
+					b = tr_buffers::create_read_buffer(read_ahead);
+
+				// the one at buffer start is larger than read-ahead, only this one goes to a larger buffer
+				if (read_state::body == ctx->r_state && b->size() < ctx->r_msg_len)
+					b->resize_to(ctx->r_msg_len);
+
+				return b->free_part();
+			}
+
+			template<class ConnectionT>
+			static rd_consume_status_t consume_buffer_read_ahead(ConnectionT *c, buffer_ref read_part)
+			{
+				context_t *ctx = c;
+				buffer_move_ptr& b = ctx->r_buf;
+				b->advance_last(read_part.size());
+
+				str_ref msgs[read_ahead_batch];
+				size_t n_msgs = 0;
+
+				char *p = b->first;
+				while (true)
+				{
+					size_t const avail = b->last - p;
+
+					if (read_state::header == ctx->r_state)
+					{
+						if (avail < tr::header_size)
+							break;
+
+						// messages sliced before this one are not delivered if the header is bad
+						//  the connection is being aborted
+						ssize_t const body_length = MEOW_LIBEV_GENERIC_CONNECTION_CTX_CALLBACK(c, on_header, str_ref(p, tr::header_size));
+						if (body_length < 0)
+							return rd_consume_status::closed;
+
+						ctx->r_state = read_state::body;
+						ctx->r_msg_len = tr::header_size + body_length;
+					}
+
+					if (avail < ctx->r_msg_len)
+						break;
+
+					msgs[n_msgs++] = str_ref(p, ctx->r_msg_len);
+					p += ctx->r_msg_len;
+
+					ctx->r_state = read_state::header;
+					ctx->r_msg_len = 0;
+
+					if (read_ahead_batch == n_msgs)
+					{
+						MEOW_LIBEV_GENERIC_CONNECTION_CTX_CALLBACK(c, on_messages, msgs, n_msgs);
+						n_msgs = 0;
+
+						if (c->is_closing())
+							return rd_consume_status::loop_break;
+					}
+				}
+
+				if (n_msgs > 0)
+				{
+					MEOW_LIBEV_GENERIC_CONNECTION_CTX_CALLBACK(c, on_messages, msgs, n_msgs);
+
+					if (c->is_closing())
+						return rd_consume_status::loop_break;
+				}
+
+				// nothing left, the buffer goes back (to the pool), idle connections don't keep it
+				size_t const tail_size = b->last - p;
+				if (0 == tail_size)
+				{
+					b.reset();
+					return rd_consume_status::more;
+				}
+
+				// the trailing partial message
+				if (p != b->first)
+				{
+					b->clear();
+					std::memmove(b->first, p, tail_size);
+					b->advance_last(tail_size);
+				}
+
 				return rd_consume_status::more;
 			}
 		};
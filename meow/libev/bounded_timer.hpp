@@ -6,6 +6,7 @@
 #ifndef MEOW_LIBEV__BOUNDED_TIMER_HPP_
 #define MEOW_LIBEV__BOUNDED_TIMER_HPP_
 
+#include <cstdint>
 #include <functional> // std::function
 
 #include <boost/noncopyable.hpp>
@@ -33,6 +34,7 @@ namespace meow { namespace libev {
 		struct node_t : public node_hook_t
 		{
 			callback_t timer_callback;
+			uint64_t   timer_expires_tick = 0; // implementation private, for multi-level ones
 		};
 
 	public:
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__CONNECTION_MIGRATION_HPP_
+#define MEOW_LIBEV__CONNECTION_MIGRATION_HPP_
+
+#include <functional> // function
+#include <mutex>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/libev/libev_fwd.hpp>
+#include <meow/libev/detail/generic_connection.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// moves live connections to a loop run by another thread
+//  everything stays in the connection: queued writes, read context, cork, flags
+//  io is stopped on the old loop, pending activations dropped
+//  and restarted on the new one, with read and write (and a pending custom op) activated
+//
+// migrate() is called from the thread running c->loop(), but not from within c's own callbacks
+//  (run_loop() would go on using the old loop), a timer or another connection is fine
+// after migrate() the calling thread must not touch the connection anymore
+//
+// libev watchers can't be started or stopped from other threads
+//  so the target is created before its loop is run (or from the thread running it) and destroyed after
+//
+// the connection's events_t (if it's loop specific) is to be replaced from on_arrived
+// connections with io not started are moved as is, io is not started on the new loop either
+// io_uring engine: in-flight ops are cancelled, ones that have already completed are delivered on the new loop
+
+	struct connection_migration_target_t : private boost::noncopyable
+	{
+		typedef connection_migration_target_t self_t;
+
+		// called from the target loop thread, after the connection has been activated there
+		typedef std::function<void(generic_connection_t*)> callback_t;
+
+		explicit connection_migration_target_t(evloop_t *loop)
+			: loop_(loop)
+		{
+			ev_async_init(&ev_, &libev_cb);
+			ev_.data = this;
+			ev_async_start(loop_, &ev_);
+		}
+
+		~connection_migration_target_t()
+		{
+			ev_async_stop(loop_, &ev_);
+
+			// they're detached from everything, so nobody else is going to
+			for (item_t& item : queue_)
+				delete item.c;
+		}
+
+		evloop_t* loop() const { return loop_; }
+
+		void migrate(generic_connection_t *c, callback_t const& on_arrived = callback_t())
+		{
+			item_t item = { c, c->loop_detach(), on_arrived };
+
+			{
+				std::lock_guard<std::mutex> g_(lock_);
+				queue_.push_back(item);
+			}
+
+			ev_async_send(loop_, &ev_);
+		}
+
+	private:
+
+		struct item_t
+		{
+			generic_connection_t *c;
+			int                   resume_ops;
+			callback_t            on_arrived;
+		};
+
+		static void libev_cb(evloop_t*, evasync_t *ev, int revents)
+		{
+			self_t *self = static_cast<self_t*>(ev->data);
+
+			std::vector<item_t> items;
+			{
+				std::lock_guard<std::mutex> g_(self->lock_);
+				items.swap(self->queue_);
+			}
+
+			for (item_t& item : items)
+			{
+				item.c->loop_attach(self->loop_, item.resume_ops);
+
+				if (item.on_arrived)
+					item.on_arrived(item.c);
+			}
+		}
+
+	private:
+		evloop_t             *loop_;
+		evasync_t             ev_;
+
+		std::mutex            lock_;
+		std::vector<item_t>   queue_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__CONNECTION_MIGRATION_HPP_
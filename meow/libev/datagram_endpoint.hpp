@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__DATAGRAM_ENDPOINT_HPP_
+#define MEOW_LIBEV__DATAGRAM_ENDPOINT_HPP_
+
+#include <cstdint>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/buffer.hpp>
+#include <meow/std_unique_ptr.hpp>
+#include <meow/libev/libev_fwd.hpp>
+#include <meow/unix/ipv4_address.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct datagram_t
+	{
+		ipv4::address_t addr; // where it came from or goes to
+		buffer_move_ptr buf;
+	};
+
+	// udp socket on a loop, receives and sends datagrams in batches (recvmmsg() and sendmmsg())
+	//  see datagram_endpoint_impl.hpp for the options
+	struct datagram_endpoint_t : private boost::noncopyable
+	{
+		struct events_t
+		{
+			virtual ~events_t() {}
+
+			// a batch from a single recvmmsg()
+			//  buffers can be moved out of datagrams, the ones left are reused for the next batch
+			//  shutdown() is fine to call from here, deleting the endpoint is not
+			virtual void on_datagrams(datagram_endpoint_t*, datagram_t *dgrams, size_t n_dgrams) = 0;
+
+			// errors from recvmmsg() and sendmmsg() other than EAGAIN
+			//  i.e. ECONNREFUSED from an earlier send, a failed datagram is dropped
+			virtual void on_error(datagram_endpoint_t*, int err) {}
+		};
+
+		struct stats_t
+		{
+			uint64_t rx_datagrams  = 0;
+			uint64_t rx_syscalls   = 0;
+			uint64_t rx_truncated  = 0; // larger than the receive buffer, the rest is lost
+
+			uint64_t tx_datagrams  = 0;
+			uint64_t tx_syscalls   = 0;
+			uint64_t tx_segmented  = 0; // datagrams sent as part of UDP_SEGMENT messages
+			uint64_t tx_dropped    = 0; // send queue was full
+			uint64_t tx_errors     = 0; // rejected by sendmmsg()
+		};
+
+	public:
+
+		virtual ~datagram_endpoint_t() {}
+
+		virtual int              fd() const = 0;
+		virtual evloop_t*        loop() const = 0;
+		virtual ipv4::address_t  local_address() const = 0;
+
+		// queues a datagram, the queue is sent with as few syscalls as possible
+		//  at the end of current loop iteration (or when the socket becomes writable)
+		virtual void             send(ipv4::address_t const& to, buffer_move_ptr) = 0;
+		virtual void             flush() = 0; // send what's queued right now
+		virtual size_t           send_queue_size() const = 0;
+
+		// stops io and closes the socket, queued datagrams are dropped
+		virtual void             shutdown() = 0;
+
+		virtual stats_t const&   stats() const = 0;
+	};
+
+	typedef std::unique_ptr<datagram_endpoint_t> datagram_endpoint_move_ptr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__DATAGRAM_ENDPOINT_HPP_
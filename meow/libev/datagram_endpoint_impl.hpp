@@ -0,0 +1,451 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__DATAGRAM_ENDPOINT_IMPL_HPP_
+#define MEOW_LIBEV__DATAGRAM_ENDPOINT_IMPL_HPP_
+
+#include <sys/socket.h>  // recvmmsg(), sendmmsg()
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#include <cerrno>
+#include <cstring>       // memset
+#include <deque>
+
+#include <meow/api_call_error.hpp>
+#include <meow/buffer_pool.hpp>
+#include <meow/utility/nested_name_alias.hpp>
+
+#include <meow/unix/fd_handle.hpp>
+#include <meow/unix/socket.hpp>
+
+#include <meow/libev/io_context.hpp>
+#include <meow/libev/datagram_endpoint.hpp>
+
+#ifndef UDP_SEGMENT
+#	define UDP_SEGMENT 103 // linux 4.18+, older libc headers don't have it
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Traits may have any of these, defaults are shown
+//  struct option_datagram_batch { enum { value = 32 }; };              // datagrams per recvmmsg() and sendmmsg()
+//  struct option_datagram_max_size { enum { value = 2048 }; };         // receive buffer size for a datagram
+//  struct option_datagram_rx_batches { enum { value = 4 }; };          // recvmmsg() calls per wakeup at most, for fairness
+//  struct option_datagram_send_queue_max { enum { value = 0 }; };      // datagrams, 0 = unlimited
+//  struct option_udp_segment { enum { value = false }; };               // UDP_SEGMENT (GSO) for same destination bursts
+//
+// with UDP_SEGMENT, consecutive queued datagrams to the same address go as one message
+//  when they're of the same size (the last one may be shorter), that's what the kernel allows
+//  it's turned off by itself if the socket or the device says it's not supported
+
+	struct datagram_endpoint_default_traits {};
+
+	template<class Traits = datagram_endpoint_default_traits>
+	struct datagram_endpoint_impl_t : public datagram_endpoint_t
+	{
+		typedef datagram_endpoint_impl_t self_t;
+
+		struct option_datagram_batch_default { enum { value = 32 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_datagram_batch, option_datagram_batch_default);
+
+		struct option_datagram_max_size_default { enum { value = 2048 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_datagram_max_size, option_datagram_max_size_default);
+
+		struct option_datagram_rx_batches_default { enum { value = 4 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_datagram_rx_batches, option_datagram_rx_batches_default);
+
+		struct option_datagram_send_queue_max_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_datagram_send_queue_max, option_datagram_send_queue_max_default);
+
+		struct option_udp_segment_default { enum { value = false }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_udp_segment, option_udp_segment_default);
+
+		enum
+		{
+			batch           = option_datagram_batch::value,
+			max_size        = option_datagram_max_size::value,
+			rx_batches      = option_datagram_rx_batches::value,
+			send_queue_max  = option_datagram_send_queue_max::value,
+
+			gso_max_segments = 64,
+			gso_max_bytes    = 65507, // max udp payload over ipv4
+		};
+
+		static_assert(batch > 0 && batch <= 1024, "option_datagram_batch must be in [1, UIO_MAXIOV]");
+		static_assert(max_size > 0, "option_datagram_max_size must be positive");
+		static_assert(rx_batches > 0, "option_datagram_rx_batches must be positive");
+
+	public:
+
+		// takes ownership of fd, it must be a non-blocking udp socket
+		datagram_endpoint_impl_t(evloop_t *loop, int fd, events_t *ev)
+			: loop_(loop)
+			, ev_(ev)
+			, io_ctx_(fd)
+			, wait_ops_(EV_READ)
+			, gso_enabled_(option_udp_segment::value)
+		{
+			ev_io_init(io_ctx_.event(), &libev_cb, fd, wait_ops_);
+			io_ctx_.event()->data = this;
+			ev_io_start(loop_, io_ctx_.event());
+
+			ev_prepare_init(&flush_ev_, &flush_cb);
+			flush_ev_.data = this;
+		}
+
+		~datagram_endpoint_impl_t()
+		{
+			this->shutdown();
+		}
+
+	public:
+
+		virtual int fd() const override { return io_ctx_.fd(); }
+		virtual evloop_t* loop() const override { return loop_; }
+
+		virtual ipv4::address_t local_address() const override
+		{
+			sockaddr_in sa = {};
+			socklen_t sa_len = sizeof(sa);
+			if (-1 == ::getsockname(fd(), (sockaddr*)&sa, &sa_len))
+				throw meow::api_call_error("getsockname(%d)", fd());
+			return ipv4::address_t(sa);
+		}
+
+		virtual void send(ipv4::address_t const& to, buffer_move_ptr buf) override
+		{
+			if (!buf || !io_ctx_.is_valid())
+				return;
+
+			if (send_queue_max && tx_queue_.size() >= (size_t)send_queue_max)
+			{
+				stats_.tx_dropped++;
+				return;
+			}
+
+			bool const was_empty = tx_queue_.empty();
+
+			tx_queue_.push_back(datagram_t { to, move(buf) });
+
+			// everything queued in this loop iteration goes in one go, before the loop polls
+			//  unless the socket is full, then it goes when it's writable
+			if (was_empty && !(wait_ops_ & EV_WRITE))
+				ev_prepare_start(loop_, &flush_ev_);
+		}
+
+		virtual void flush() override
+		{
+			if (!io_ctx_.is_valid())
+				return;
+
+			ev_prepare_stop(loop_, &flush_ev_);
+			this->write_queue();
+		}
+
+		virtual size_t send_queue_size() const override
+		{
+			return tx_queue_.size();
+		}
+
+		virtual void shutdown() override
+		{
+			if (!io_ctx_.is_valid())
+				return;
+
+			// clears pending events as well
+			ev_io_stop(loop_, io_ctx_.event());
+			ev_prepare_stop(loop_, &flush_ev_);
+			io_ctx_.reset_fd();
+			wait_ops_ = 0;
+
+			tx_queue_.clear();
+		}
+
+		virtual stats_t const& stats() const override
+		{
+			return stats_;
+		}
+
+	private:
+
+		static void libev_cb(evloop_t*, evio_t *ev, int revents)
+		{
+			self_t *self = static_cast<self_t*>(ev->data);
+
+			if (EV_READ & revents)
+				self->read_batches();
+
+			if ((EV_WRITE & revents) && self->io_ctx_.is_valid())
+				self->write_queue();
+		}
+
+		static void flush_cb(evloop_t *loop, evprepare_t *ev, int revents)
+		{
+			self_t *self = static_cast<self_t*>(ev->data);
+
+			ev_prepare_stop(loop, ev);
+			self->write_queue();
+		}
+
+		void set_wait_ops(int ops)
+		{
+			if (ops == wait_ops_ || !io_ctx_.is_valid())
+				return;
+
+			ev_io_stop(loop_, io_ctx_.event());
+			ev_io_set(io_ctx_.event(), fd(), ops);
+			ev_io_start(loop_, io_ctx_.event());
+			wait_ops_ = ops;
+		}
+
+	private: // receiving
+
+		void read_batches()
+		{
+			for (size_t round = 0; round < (size_t)rx_batches; ++round)
+			{
+				for (size_t i = 0; i < (size_t)batch; ++i)
+				{
+					if (!rx_bufs_[i])
+						rx_bufs_[i] = create_buffer_from_pool(max_size);
+					rx_bufs_[i]->clear();
+
+					rx_iov_[i].iov_base = rx_bufs_[i]->first;
+					rx_iov_[i].iov_len  = rx_bufs_[i]->size();
+
+					msghdr& h = rx_msgs_[i].msg_hdr;
+					memset(&h, 0, sizeof(h));
+					h.msg_name    = &rx_addrs_[i];
+					h.msg_namelen = sizeof(rx_addrs_[i]);
+					h.msg_iov     = &rx_iov_[i];
+					h.msg_iovlen  = 1;
+				}
+
+				int const n = ::recvmmsg(fd(), rx_msgs_, batch, MSG_DONTWAIT, NULL);
+				stats_.rx_syscalls++;
+
+				if (-1 == n)
+				{
+					if (EINTR == errno)
+						continue;
+
+					if (EAGAIN != errno && EWOULDBLOCK != errno)
+						ev_->on_error(this, errno);
+
+					return;
+				}
+
+				for (int i = 0; i < n; ++i)
+				{
+					rx_bufs_[i]->advance_last(rx_msgs_[i].msg_len);
+					if (rx_msgs_[i].msg_hdr.msg_flags & MSG_TRUNC)
+						stats_.rx_truncated++;
+
+					rx_dgrams_[i].addr = ipv4::address_t(rx_addrs_[i]);
+					rx_dgrams_[i].buf = move(rx_bufs_[i]);
+				}
+				stats_.rx_datagrams += n;
+
+				ev_->on_datagrams(this, rx_dgrams_, n);
+
+				// what's left is reused
+				for (int i = 0; i < n; ++i)
+				{
+					if (rx_dgrams_[i].buf)
+						rx_bufs_[i] = move(rx_dgrams_[i].buf);
+				}
+
+				if (!io_ctx_.is_valid() || n < batch)
+					return;
+			}
+		}
+
+	private: // sending
+
+		// can the next datagram go in the same UDP_SEGMENT message
+		bool gso_can_append(datagram_t const& prev, datagram_t const& next, size_t seg_size, size_t n_segs, size_t total) const
+		{
+			size_t const next_size = next.buf->used_size();
+
+			return gso_enabled_
+				&& (0 != seg_size)
+				&& (n_segs < (size_t)gso_max_segments)
+				&& (prev.buf->used_size() == seg_size) // only the last segment can be shorter
+				&& (0 != next_size) && (next_size <= seg_size)
+				&& (total + next_size <= (size_t)gso_max_bytes)
+				&& (prev.addr == next.addr)
+				;
+		}
+
+		// the first message failed because of UDP_SEGMENT
+		static bool is_gso_error(int err)
+		{
+			return EIO == err || EINVAL == err || ENOPROTOOPT == err || EOPNOTSUPP == err;
+		}
+
+		void write_queue()
+		{
+			if (!io_ctx_.is_valid())
+				return;
+
+			while (!tx_queue_.empty())
+			{
+				size_t n_msgs = 0;
+				size_t n_iov = 0;
+
+				typename tx_queue_t::iterator it = tx_queue_.begin();
+				while (it != tx_queue_.end() && n_iov < (size_t)batch)
+				{
+					tx_addrs_[n_msgs] = it->addr.sockaddr();
+
+					msghdr& h = tx_msgs_[n_msgs].msg_hdr;
+					memset(&h, 0, sizeof(h));
+					h.msg_name    = &tx_addrs_[n_msgs];
+					h.msg_namelen = sizeof(tx_addrs_[n_msgs]);
+					h.msg_iov     = &tx_iov_[n_iov];
+
+					size_t const seg_size = it->buf->used_size();
+					size_t n_segs = 0;
+					size_t total = 0;
+
+					while (true)
+					{
+						tx_iov_[n_iov].iov_base = it->buf->first;
+						tx_iov_[n_iov].iov_len  = it->buf->used_size();
+						total += it->buf->used_size();
+						++n_iov;
+						++n_segs;
+
+						typename tx_queue_t::iterator prev = it++;
+						if (it == tx_queue_.end() || n_iov >= (size_t)batch || !gso_can_append(*prev, *it, seg_size, n_segs, total))
+							break;
+					}
+
+					h.msg_iovlen = n_segs;
+
+					if (n_segs > 1)
+					{
+						h.msg_control    = tx_cmsg_[n_msgs];
+						h.msg_controllen = sizeof(tx_cmsg_[n_msgs]);
+
+						cmsghdr *cm = CMSG_FIRSTHDR(&h);
+						cm->cmsg_level = SOL_UDP;
+						cm->cmsg_type  = UDP_SEGMENT;
+						cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+						*(uint16_t*)CMSG_DATA(cm) = seg_size;
+					}
+
+					tx_segs_[n_msgs] = n_segs;
+					++n_msgs;
+				}
+
+				int const n = ::sendmmsg(fd(), tx_msgs_, n_msgs, MSG_DONTWAIT);
+				stats_.tx_syscalls++;
+
+				if (-1 == n)
+				{
+					int const err = errno;
+
+					if (EINTR == err)
+						continue;
+
+					if (EAGAIN == err || EWOULDBLOCK == err)
+					{
+						this->set_wait_ops(EV_READ | EV_WRITE);
+						return;
+					}
+
+					if (tx_segs_[0] > 1 && is_gso_error(err))
+					{
+						gso_enabled_ = false;
+						continue;
+					}
+
+					// the first message is bad, drop it and go on
+					stats_.tx_errors += tx_segs_[0];
+					this->pop_sent(tx_segs_[0]);
+
+					ev_->on_error(this, err);
+					if (!io_ctx_.is_valid())
+						return;
+
+					continue;
+				}
+
+				size_t n_sent = 0;
+				for (int i = 0; i < n; ++i)
+				{
+					n_sent += tx_segs_[i];
+					if (tx_segs_[i] > 1)
+						stats_.tx_segmented += tx_segs_[i];
+				}
+
+				stats_.tx_datagrams += n_sent;
+				this->pop_sent(n_sent);
+			}
+
+			this->set_wait_ops(EV_READ);
+		}
+
+		void pop_sent(size_t n)
+		{
+			tx_queue_.erase(tx_queue_.begin(), tx_queue_.begin() + n);
+		}
+
+	private:
+		typedef std::deque<datagram_t> tx_queue_t;
+
+		evloop_t      *loop_;
+		events_t      *ev_;
+		io_context_t  io_ctx_;
+		evprepare_t   flush_ev_; // sends the queue before the loop goes to poll
+		int           wait_ops_;
+		bool          gso_enabled_;
+		stats_t       stats_;
+
+		buffer_move_ptr  rx_bufs_[batch];
+		datagram_t       rx_dgrams_[batch];
+		sockaddr_in      rx_addrs_[batch];
+		iovec            rx_iov_[batch];
+		mmsghdr          rx_msgs_[batch];
+
+		tx_queue_t       tx_queue_;
+		sockaddr_in      tx_addrs_[batch];
+		iovec            tx_iov_[batch];
+		mmsghdr          tx_msgs_[batch];
+		size_t           tx_segs_[batch];
+		char             tx_cmsg_[batch][CMSG_SPACE(sizeof(uint16_t))];
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// udp socket bound to addr (port 0 for any), SO_REUSEADDR is set
+	template<class Traits, class L>
+	inline datagram_endpoint_move_ptr start_datagram_endpoint(L& loop, ipv4::address_t const& addr, datagram_endpoint_t::events_t *ev)
+	{
+		os_unix::fd_handle_t s(os_unix::socket_ex(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+		os_unix::setsockopt_ex(get_handle(s), SOL_SOCKET, SO_REUSEADDR, int(~0));
+		os_unix::bind_ex(get_handle(s), (sockaddr*)addr.sockaddr_tmp(), addr.addrlen());
+
+		datagram_endpoint_move_ptr d(new datagram_endpoint_impl_t<Traits>(get_handle(loop), get_handle(s), ev));
+		s.release();
+		return move(d);
+	}
+
+	template<class L>
+	inline datagram_endpoint_move_ptr start_datagram_endpoint(L& loop, ipv4::address_t const& addr, datagram_endpoint_t::events_t *ev)
+	{
+		return start_datagram_endpoint<datagram_endpoint_default_traits>(loop, addr, ev);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__DATAGRAM_ENDPOINT_IMPL_HPP_
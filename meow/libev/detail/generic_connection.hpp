@@ -11,6 +11,7 @@
 #include <meow/bitfield_union.hpp>
 #include <meow/buffer.hpp>
 #include <meow/buffer_chain.hpp>
+#include <meow/buffer_shared.hpp>
 
 #include <meow/libev/libev_fwd.hpp>
 
@@ -45,6 +46,15 @@ namespace meow { namespace libev {
 
 			// if io_startup() was called more times than io_shutdown()
 			bool io_started          : 1;
+
+			// writes are held back till uncork()
+			bool is_corked           : 1;
+
+			// wakeups left to keep waiting for EV_WRITE with nothing to write, see option_write_wait_linger
+			unsigned write_linger_left : 8;
+
+			// write queue has grown over option_write_high_watermark and is not below the low one yet
+			bool write_blocked       : 1;
 		};
 		typedef meow::bitfield_union<flags_data_t, uint32_t> flags_t;
 
@@ -54,8 +64,14 @@ namespace meow { namespace libev {
 
 		struct io_stats_t
 		{
-			uint64_t bytes_read    = 0; // not implemmented
+			// always counted, see meow/libev/io_stats.hpp for the detailed ones
+			uint64_t bytes_read    = 0;
 			uint64_t bytes_written = 0;
+
+			// times run_loop() stopped short of an op because of traits::budget
+			uint64_t read_budget_hits   = 0;
+			uint64_t write_budget_hits  = 0;
+			uint64_t custom_budget_hits = 0;
 		};
 		io_stats_t io_stats;
 
@@ -83,12 +99,29 @@ namespace meow { namespace libev {
 		virtual void send(buffer_move_ptr) = 0;
 		virtual void send_chain(buffer_chain_t&) = 0;
 
+		// the same data to any number of connections, without copies, see meow/buffer_shared.hpp
+		inline void send_shared(shared_buffer_ptr const& b) { this->send(b->view()); }
+
 		virtual bool has_buffers_to_send() const = 0;
+		virtual size_t write_queue_bytes() const = 0; // queued and not written yet, see option_write_high_watermark
+
+		// batch the writes from several callbacks into one syscall
+		//  cork() holds everything queued from now on, uncork() sends it
+		//  uncork() is called by itself at the end of current loop iteration (before it goes to poll)
+		virtual void cork() = 0;
+		virtual void uncork() = 0;
+		inline bool is_corked() const { return flags->is_corked; }
 
 	public: // access to semi-private information for the brave
 
 		virtual void set_loop(evloop_t*) = 0;   // change event loop, USE WITH EXTREME CARE
 
+		// moving a live connection to another loop (and thread), see meow/libev/connection_migration.hpp
+		//  detach stops everything on the current loop and returns ops to resume with
+		//  attach starts io on the new loop, from the thread running it
+		virtual int  loop_detach() = 0;
+		virtual void loop_attach(evloop_t*, int resume_ops) = 0;
+
 		virtual buffer_chain_t& wchain_ref() = 0;
 
 	public: // closing
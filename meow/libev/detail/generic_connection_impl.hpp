@@ -6,6 +6,7 @@
 #ifndef MEOW_LIBEV_DETAIL__GENERIC_CONNECTION_IMPL_HPP_
 #define MEOW_LIBEV_DETAIL__GENERIC_CONNECTION_IMPL_HPP_
 
+#include <algorithm> // min
 #include <stdexcept>
 #include <type_traits>
 
@@ -29,6 +30,9 @@ namespace meow { namespace libev {
 	struct generic_connection_impl_t
 		: public Interface
 		, public Traits::read::context_t
+		, public generic_connection_io_engine_traits<Traits>::io_engine::context_t
+		, public generic_connection_zerocopy_traits<Traits>::context_t
+		, public generic_connection_io_stats_traits<Traits>::context_t
 	{
 		typedef generic_connection_impl_t 		self_t;
 		typedef generic_connection_impl_t 		base_t; // macro at the bottom uses it
@@ -66,28 +70,52 @@ namespace meow { namespace libev {
 							break;
 					}
 
-					return Traits::read::consume_buffer(ctx, read_part, r_status);
+					uint64_t const started = io_stats_collector::consume_begin(ctx);
+					rd_consume_status_t const c_status = Traits::read::consume_buffer(ctx, read_part, r_status);
+
+					// ctx is gone if closed
+					if (rd_consume_status::closed != c_status)
+						io_stats_collector::consume_end(ctx, started);
+
+					return c_status;
 				}
 			};
 
+			typedef typename generic_connection_io_stats_traits<Traits>::io_stats_collector io_stats_collector;
+
 			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, base,      typename default_traits::base);
 			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, virtuals,  typename default_traits::virtuals);
-			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, write,     typename default_traits::write);
+			MEOW_DEFINE_NESTED_NAME_ALIAS_EX(Traits, write, user_write, typename default_traits::write, typename default_traits::write);
+			typedef typename generic_connection_write_watermark_traits<Traits>::template write_t<user_write> write;
 			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, custom_op, typename default_traits::custom_op);
 
-			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_VOID(Traits, allowed_ops);
 			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_VOID(Traits, read_precheck);
 			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_VOID(Traits, log_writer);
 			MEOW_DEFINE_NESTED_NAME_ALIAS_OR_VOID(Traits, activity_tracker);
+
+			MEOW_DEFINE_NESTED_NAME_ALIAS_EX(Traits, budget, user_budget, void, void);
+			typedef typename generic_connection_budget_traits<user_budget>::type budget;
+
+			MEOW_DEFINE_NESTED_NAME_ALIAS_EX(Traits, allowed_ops, user_allowed_ops, void, void);
+			typedef typename generic_connection_allowed_ops_traits<user_allowed_ops>::type allowed_ops;
+
+			typedef typename generic_connection_write_linger_traits<Traits>::type write_linger;
 		};
 
-		typedef libev::io_machine_t<self_t, traits_t>  iomachine_t;
+		typedef generic_connection_coalesce_traits<Traits> tr_coalesce;
+		typedef generic_connection_write_watermark_traits<Traits> tr_watermark;
+
+		typedef typename generic_connection_io_engine_traits<Traits>::io_engine  io_engine_t;
+		typedef typename io_engine_t::template machine<self_t, traits_t>::type  iomachine_t;
 
 	public:
 		struct option_automatic_startup_io_default { enum { value = true }; };
 		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_automatic_startup_io, option_automatic_startup_io_default);
 
 	public:
+		// fds from listeners are non-blocking already (accept4() with SOCK_NONBLOCK)
+		//  connections that only get those can save a fcntl() pair on startup with
+		//  struct option_automatic_set_nonblocking { enum { value = false }; };
 		struct option_automatic_set_nonblocking_default { enum { value = true }; };
 		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_automatic_set_nonblocking, option_automatic_set_nonblocking_default);
 
@@ -99,6 +127,8 @@ namespace meow { namespace libev {
 		events_t 		*ev_;
 		io_context_t 	io_ctx_;
 		buffer_chain_t 	wchain_;
+		size_t          wq_bytes_; // in wchain_, see option_write_high_watermark
+		evprepare_t 	cork_ev_; // uncorks before the loop goes to poll
 
 	public: // callbacks, for the traits
 
@@ -113,14 +143,29 @@ namespace meow { namespace libev {
 			: loop_(loop)
 			, ev_(ev)
 			, io_ctx_(fd)
+			, wq_bytes_(0)
 		{
+			ev_prepare_init(&cork_ev_, &self_t::cork_cb);
+			cork_ev_.data = this;
+
 			if (option_automatic_startup_io::value)
 				this->io_startup();
 		}
 
 		virtual ~generic_connection_impl_t()
 		{
+			ev_prepare_stop(loop_, &cork_ev_);
 			this->io_shutdown();
+			this->zc_linger(std::integral_constant<bool, (generic_connection_zerocopy_traits<Traits>::threshold > 0)>());
+		}
+
+	private:
+
+		// zerocopy buffers the kernel might still be sending from outlive the connection, with the fd
+		void zc_linger(std::false_type) {}
+		void zc_linger(std::true_type)
+		{
+			generic_connection_zerocopy_linger_t::on_close(loop_, io_ctx_, wchain_, *this);
 		}
 
 	public:
@@ -160,6 +205,7 @@ namespace meow { namespace libev {
 		virtual void io_reset() override
 		{
 			io_shutdown();
+			this->zc_linger(std::integral_constant<bool, (generic_connection_zerocopy_traits<Traits>::threshold > 0)>());
 			io_ctx_.reset_fd();
 		}
 
@@ -182,12 +228,24 @@ namespace meow { namespace libev {
 			if (!buf || buf->empty())
 				return;
 
-			wchain_.push_back(move(buf));
+			size_t const sz = tr_watermark::buffer_bytes(*buf);
+
+			traits_t::io_stats_collector::on_queue(this);
+			tr_coalesce::queue(wchain_, move(buf));
+
+			this->wq_queued(sz);
 		}
 
 		virtual void queue_chain(buffer_chain_t& chain) override
 		{
+			size_t sz = 0;
+			for (buffer_chain_t::iterator i = chain.begin(); i != chain.end(); ++i)
+				sz += tr_watermark::buffer_bytes(**i);
+
+			traits_t::io_stats_collector::on_queue(this);
 			wchain_.append_chain(chain);
+
+			this->wq_queued(sz);
 		}
 
 		virtual void send(buffer_move_ptr buf) override
@@ -212,11 +270,138 @@ namespace meow { namespace libev {
 			return traits_t::virtuals::has_buffers_to_send(this);
 		}
 
+		virtual size_t write_queue_bytes() const override
+		{
+			return wq_bytes_;
+		}
+
+	public: // write queue accounting, for the traits
+
+		void wq_queued(size_t sz)
+		{
+			wq_bytes_ += sz;
+
+			if (tr_watermark::queue_limit && wq_bytes_ > (size_t)tr_watermark::queue_limit && !this->flags->is_closing)
+			{
+				this->close_immediately();
+				return;
+			}
+
+			this->wq_check_blocked(typename tr_watermark::has_watermarks());
+		}
+
+		void wq_written(size_t sz)
+		{
+			wq_bytes_ -= std::min(sz, wq_bytes_);
+
+			// resync when it's all gone, tls records are counted in place of the data
+			if (wq_bytes_ > 0 && !this->has_buffers_to_send())
+				wq_bytes_ = 0;
+
+			this->wq_check_drained(typename tr_watermark::has_watermarks());
+		}
+
+	private:
+
+		void wq_check_blocked(std::false_type) {}
+		void wq_check_blocked(std::true_type)
+		{
+			if (this->flags->write_blocked || wq_bytes_ < (size_t)tr_watermark::high_watermark)
+				return;
+
+			this->flags->write_blocked = true;
+			ev_->on_write_blocked(this);
+		}
+
+		void wq_check_drained(std::false_type) {}
+		void wq_check_drained(std::true_type)
+		{
+			if (!this->flags->write_blocked || wq_bytes_ > (size_t)tr_watermark::low_watermark)
+				return;
+
+			this->flags->write_blocked = false;
+			ev_->on_write_drained(this);
+		}
+
+	public:
+
+		virtual void cork() override
+		{
+			if (this->flags->is_corked)
+				return;
+
+			this->flags->is_corked = true;
+			ev_prepare_start(loop_, &cork_ev_);
+		}
+
+		virtual void uncork() override
+		{
+			if (!this->flags->is_corked)
+				return;
+
+			this->flags->is_corked = false;
+			ev_prepare_stop(loop_, &cork_ev_);
+
+			if (this->flags->io_started && this->has_buffers_to_send())
+				this->w_activate();
+		}
+
+	private:
+
+		static void cork_cb(evloop_t *loop, evprepare_t *ev, int revents)
+		{
+			self_t *self = static_cast<self_t*>(ev->data);
+			self->uncork();
+		}
+
 	public:
 
 		virtual void set_loop(evloop_t *loop) override
 		{
+			// the prepare watcher goes along
+			bool const is_corked = this->flags->is_corked;
+			if (is_corked)
+				ev_prepare_stop(loop_, &cork_ev_);
+
 			loop_ = loop;
+
+			if (is_corked)
+				ev_prepare_start(loop_, &cork_ev_);
+		}
+
+		virtual int loop_detach() override
+		{
+			// readiness is checked again on the new loop, a pending custom op is the only thing to carry over
+			//  EV_NONE == io was not started, and is not started on the new loop either
+			int resume_ops = EV_NONE;
+
+			if (this->flags->io_started)
+			{
+				resume_ops = EV_READ | EV_WRITE | (ev_clear_pending(loop_, io_ctx_.event()) & EV_CUSTOM);
+
+				// keeps completed, but not yet delivered io, to be delivered on the new loop
+				iomachine_t::detach_context(this);
+				this->flags->io_started = false;
+			}
+
+			if (this->flags->is_corked)
+				ev_prepare_stop(loop_, &cork_ev_);
+
+			return resume_ops;
+		}
+
+		virtual void loop_attach(evloop_t *loop, int resume_ops) override
+		{
+			loop_ = loop;
+
+			if (this->flags->is_corked)
+				ev_prepare_start(loop_, &cork_ev_);
+
+			if (EV_NONE == resume_ops)
+				return;
+
+			this->io_startup();
+			this->activate(resume_ops);
 		}
 
 		virtual buffer_chain_t& wchain_ref() override
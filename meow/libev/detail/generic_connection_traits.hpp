@@ -7,10 +7,26 @@
 #define MEOW_LIBEV_DETAIL__GENERIC_CONNECTION_TRAITS_HPP_
 
 #include <sys/uio.h> // writev()
+#include <sys/sendfile.h>
+#include <fcntl.h>   // splice()
+#include <limits.h>  // IOV_MAX
+#include <sys/socket.h>
+#include <netinet/in.h>      // IP_RECVERR
+#include <linux/errqueue.h>  // sock_extended_err
+
+#include <cstdint>   // SIZE_MAX
+#include <algorithm> // std::min
+#include <deque>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <meow/utility/offsetof.hpp> 	// for MEOW_SELF_FROM_MEMBER
+#include <meow/utility/nested_name_alias.hpp>
 
 #include <meow/buffer.hpp>
+#include <meow/buffer_pool.hpp>
+#include <meow/buffer_file_region.hpp>
 #include <meow/buffer_chain.hpp>
 
 #include <meow/format/format.hpp> 		// FMT_TEMPLATE_PARAMS, etc.
@@ -20,6 +36,7 @@
 #include <meow/libev/io_context.hpp>
 #include <meow/libev/io_machine.hpp> 	// read/write statuses
 #include <meow/libev/io_close_report.hpp>
+#include <meow/libev/io_stats.hpp>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace meow { namespace libev {
@@ -46,6 +63,520 @@ namespace meow { namespace libev {
 		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, log_writer, log_writer__default);
 	};
 
+	// io execution engine, io_machine_engine_t (readiness, default) or io_uring_machine_engine_t
+	template<class Traits>
+	struct generic_connection_io_engine_traits
+	{
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, io_engine, io_machine_engine_t);
+	};
+
+	// shared read buffer for all connections of this thread's loop
+	//  readers copy out only the unconsumed tail, so idle connections don't hold any read memory
+	//  in_use is set while the data is being consumed, callbacks reading other connections get their own buffers
+	struct read_scratch_buffer_t : private boost::noncopyable
+	{
+		static size_t const default_size = 64 * 1024;
+
+		buffer_t buf;
+		bool     in_use;
+
+		read_scratch_buffer_t()
+			: buf(default_size)
+			, in_use(false)
+		{
+		}
+
+		// start with the tail left from the previous read and at least read_room bytes free
+		buffer_ref take(str_ref const& tail, size_t read_room)
+		{
+			buf.clear();
+
+			size_t const need_sz = tail.size() + read_room;
+			if (buf.size() < need_sz)
+				buf.resize_to(need_sz);
+
+			if (!tail.empty())
+				copy_to_buffer(buf, tail.data(), tail.size());
+
+			return buf.free_part();
+		}
+
+		// the read has been done into this buffer, by the last take()
+		bool owns(buffer_ref const& read_part) const
+		{
+			return !in_use && (read_part.begin() == buf.last);
+		}
+
+		static read_scratch_buffer_t* this_thread()
+		{
+			static thread_local read_scratch_buffer_t s;
+			return &s;
+		}
+	};
+
+	// read buffers allocation
+	//  opt into this thread's buffer_pool_t with
+	//   struct option_read_buffer_pool { enum { value = true }; };
+	//  and into the shared read_scratch_buffer_t (for readers that support it) with
+	//   struct option_read_scratch_buffer { enum { value = true }; };
+	//   never used with the engines that keep buffers in flight
+	template<class Traits>
+	struct generic_connection_buffer_traits
+	{
+		struct option_read_buffer_pool_default { enum { value = false }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_read_buffer_pool, option_read_buffer_pool_default);
+
+		struct option_read_scratch_buffer_default { enum { value = false }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_EX(Traits, option_read_scratch_buffer, user_option_read_scratch_buffer, option_read_scratch_buffer_default, option_read_scratch_buffer_default);
+
+		struct option_read_scratch_buffer
+		{
+			enum { value = user_option_read_scratch_buffer::value
+							&& !generic_connection_io_engine_traits<Traits>::io_engine::buffers_in_flight };
+		};
+
+		static buffer_move_ptr create_read_buffer(size_t sz)
+		{
+			return (option_read_buffer_pool::value)
+					? create_buffer_from_pool(sz)
+					: create_buffer(sz)
+					;
+		}
+	};
+
+	// small writes coalescing, enabled with
+	//  struct option_write_coalesce_size { enum { value = 512 }; };
+	//  queued buffers of up to that many bytes are copied into free space of the chain tail
+	//  or start a new tail (a fresh pooled one, if they don't have enough room for more themselves)
+	//
+	// queued data is never moved or reallocated, only appended to
+	//  so writes in flight (io_uring, zerocopy) keep pointing at the right bytes
+	template<class Traits>
+	struct generic_connection_coalesce_traits
+	{
+		struct option_write_coalesce_size_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_write_coalesce_size, option_write_coalesce_size_default);
+
+		enum
+		{
+			coalesce_size    = option_write_coalesce_size::value,
+			tail_buffer_size = 4096,
+		};
+
+		static void queue(buffer_chain_t& wchain, buffer_move_ptr buf)
+		{
+			size_t const sz = buf->used_size();
+
+			if (0 == coalesce_size || sz > (size_t)coalesce_size || NULL != buf->file_region())
+			{
+				wchain.push_back(move(buf));
+				return;
+			}
+
+			// file region bytes go after the memory, can't append there
+			buffer_t *tail = (wchain.empty()) ? NULL : wchain.back();
+			if (NULL != tail && NULL == tail->file_region() && tail->free_size() >= sz)
+			{
+				copy_to_buffer(*tail, buf->first, sz);
+				return;
+			}
+
+			if (buf->free_size() < (size_t)coalesce_size)
+			{
+				buffer_move_ptr b = create_buffer_from_pool(std::max((size_t)tail_buffer_size, sz));
+				copy_to_buffer(*b, buf->first, sz);
+				buf = move(b);
+			}
+
+			wchain.push_back(move(buf));
+		}
+	};
+
+	// writes are held back while the connection is corked, see generic_connection_t::cork()
+	//  user allowed_ops traits, if any, are asked first
+	template<class AllowedOps>
+	struct generic_connection_allowed_ops_traits
+	{
+		struct type
+		{
+			template<class ContextT>
+			static int get(ContextT *ctx)
+			{
+				int const ops = AllowedOps::get(ctx);
+				return (ctx->flags->is_corked) ? (ops & ~EV_WRITE) : ops;
+			}
+		};
+	};
+
+	template<>
+	struct generic_connection_allowed_ops_traits<void>
+	{
+		struct type
+		{
+			template<class ContextT>
+			static int get(ContextT *ctx)
+			{
+				return (ctx->flags->is_corked)
+						? (EV_READ | EV_CUSTOM)
+						: (EV_READ | EV_WRITE | EV_CUSTOM)
+						;
+			}
+		};
+	};
+
+	// EV_WRITE is kept in the wait mask for a few wakeups after the write chain is empty, see iomachine_write_linger_wrap_t
+	//  helps connections that block on writes often (large responses, slow readers), keeps epoll_ctl() away
+	//  is a spurious wakeup per loop iteration for a connection that has nothing to write, so keep it small
+	//  struct option_write_wait_linger { enum { value = 4 }; };
+	template<class Traits>
+	struct generic_connection_write_linger_traits
+	{
+		struct option_write_wait_linger_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_write_wait_linger, option_write_wait_linger_default);
+
+		static_assert(option_write_wait_linger::value < 256, "option_write_wait_linger must fit flags_t::write_linger_left");
+
+		struct linger_t
+		{
+			enum { iterations = option_write_wait_linger::value };
+
+			template<class ContextT>
+			static unsigned get(ContextT *ctx) { return ctx->flags->write_linger_left; }
+
+			template<class ContextT>
+			static void set(ContextT *ctx, unsigned n) { ctx->flags->write_linger_left = n; }
+		};
+
+		typedef typename std::conditional<(option_write_wait_linger::value > 0), linger_t, void>::type type;
+	};
+
+	// write queue backpressure, the queue is counted in bytes (memory and file regions) as they're queued and written
+	//  struct option_write_high_watermark { enum { value = 1024 * 1024 }; };
+	//   events_t::on_write_blocked(c) when the queue grows to that
+	//  struct option_write_low_watermark { enum { value = 256 * 1024 }; }; // default: high / 2
+	//   events_t::on_write_drained(c) when a blocked queue gets down to that, after a write
+	//  struct option_write_queue_limit { enum { value = 16 * 1024 * 1024 }; };
+	//   close_immediately() when the queue grows over that, for the peers that don't read at all
+	//  defaults: 0, off
+	//
+	// buffers put to wchain_ref() directly are not counted
+	// tls counts the records written, a bit ahead of the data queued, it's all reset when the queue is empty
+	template<class Traits>
+	struct generic_connection_write_watermark_traits
+	{
+		struct option_write_high_watermark_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_write_high_watermark, option_write_high_watermark_default);
+
+		struct option_write_low_watermark_default { enum { value = option_write_high_watermark::value / 2 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_write_low_watermark, option_write_low_watermark_default);
+
+		struct option_write_queue_limit_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_write_queue_limit, option_write_queue_limit_default);
+
+		enum
+		{
+			high_watermark = option_write_high_watermark::value,
+			low_watermark  = option_write_low_watermark::value,
+			queue_limit    = option_write_queue_limit::value,
+		};
+
+		static_assert(0 == high_watermark || low_watermark < high_watermark, "option_write_low_watermark must be below option_write_high_watermark");
+
+		typedef std::integral_constant<bool, (high_watermark > 0)> has_watermarks;
+
+		static size_t buffer_bytes(buffer_t const& b)
+		{
+			buffer_file_region_t const *r = b.file_region();
+			return b.used_size() + ((NULL != r) ? r->length : 0);
+		}
+
+		// takes what has been written off the queue count
+		//  ctx is gone when the write is 'closed'
+		template<class Write>
+		struct write_t : public Write
+		{
+			template<class ContextT>
+			static wr_complete_status_t writev_bufs(ContextT *ctx, size_t max_bytes = 0)
+			{
+				uint64_t const written_before = ctx->io_stats.bytes_written;
+
+				wr_complete_status_t const wr = Write::writev_bufs(ctx, max_bytes);
+				if (wr_complete_status::closed != wr)
+					ctx->wq_written(ctx->io_stats.bytes_written - written_before);
+
+				return wr;
+			}
+
+			template<class ContextT>
+			static wr_complete_status_t writev_complete(ContextT *ctx, ssize_t n, size_t requested, int err_code)
+			{
+				uint64_t const written_before = ctx->io_stats.bytes_written;
+
+				wr_complete_status_t const wr = Write::writev_complete(ctx, n, requested, err_code);
+				if (wr_complete_status::closed != wr)
+					ctx->wq_written(ctx->io_stats.bytes_written - written_before);
+
+				return wr;
+			}
+		};
+	};
+
+	// detailed io stats, enabled with
+	//  typedef meow::libev::io_stats_collector_t io_stats_collector;
+	//  see meow/libev/io_stats.hpp
+	template<class Traits>
+	struct generic_connection_io_stats_traits
+	{
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, io_stats_collector, io_stats_collector_none_t);
+		typedef typename io_stats_collector::context_t context_t;
+	};
+
+	// per run_loop() io budget, user traits only need to provide get(ctx)
+	//  hits are counted in io_stats
+	template<class Budget>
+	struct generic_connection_budget_traits
+	{
+		struct type
+		{
+			template<class ContextT>
+			static io_budget_t get(ContextT *ctx)
+			{
+				return Budget::get(ctx);
+			}
+
+			template<class ContextT>
+			static void on_exhausted(ContextT *ctx, int ev_op)
+			{
+				switch (ev_op)
+				{
+					case EV_READ:   ctx->io_stats.read_budget_hits++; break;
+					case EV_WRITE:  ctx->io_stats.write_budget_hits++; break;
+					case EV_CUSTOM: ctx->io_stats.custom_budget_hits++; break;
+				}
+			}
+		};
+	};
+
+	template<>
+	struct generic_connection_budget_traits<void>
+	{
+		typedef void type;
+	};
+
+	// MSG_ZEROCOPY send state, enabled with
+	//  struct option_write_zerocopy_threshold { enum { value = 64 * 1024 }; };
+	//  writev() batches of at least that many bytes are sent with sendmsg(MSG_ZEROCOPY)
+	//  and the buffers are kept here until the kernel reports completion on socket error queue
+	//  then they are destroyed (and go back to their pool, if they came from one)
+	//
+	// the error queue is drained on every fd wakeup, pending completions make the socket report an error till then
+	// on connection destruction (or io_reset()) pending buffers and the socket go to generic_connection_zerocopy_linger_t
+	struct generic_connection_zerocopy_context_t
+	{
+		enum zc_state_t { zc_unknown, zc_enabled, zc_unsupported };
+
+		struct zc_pending_t
+		{
+			uint32_t        id;  // the last zerocopy send that has referenced the buffer
+			buffer_move_ptr buf;
+		};
+
+		struct zc_stats_t
+		{
+			uint64_t sends;       // sendmsg(MSG_ZEROCOPY) calls
+			uint64_t bytes;       // sent with them
+			uint64_t completions; // sends completed
+			uint64_t copied;      // completed sends that kernel has copied anyway (loopback, no sg support on device, etc.)
+			uint64_t fallbacks;   // ENOBUFS (optmem limit) -> written with plain copy
+		};
+
+		zc_state_t  zc_state;
+		uint32_t    zc_next_id;       // kernel counts zerocopy sends on the socket, starting from 0
+		uint32_t    zc_done_id;       // all the sends before this one have completed
+		uint32_t    zc_front_id;      // valid if zc_front_touched
+		bool        zc_front_touched; // wchain head has been partially sent with zerocopy
+
+		std::deque<zc_pending_t>                  zc_pending;
+		std::vector<std::pair<uint32_t, uint32_t>> zc_early; // completed [lo, hi] ranges, reported out of order
+		zc_stats_t                                zc_stats;
+
+		generic_connection_zerocopy_context_t()
+			: zc_state(zc_unknown)
+			, zc_next_id(0)
+			, zc_done_id(0)
+			, zc_front_id(0)
+			, zc_front_touched(false)
+			, zc_stats()
+		{
+		}
+
+		// read completion notifications from the socket error queue, release completed buffers
+		void zc_reap(int fd)
+		{
+			while (true)
+			{
+				char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+
+				struct msghdr msg = {};
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+
+				if (-1 == ::recvmsg(fd, &msg, MSG_ERRQUEUE))
+					break; // EAGAIN mostly, anything serious will surface on regular io
+
+				for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); NULL != cm; cm = CMSG_NXTHDR(&msg, cm))
+				{
+					bool const is_recverr = (SOL_IP == cm->cmsg_level && IP_RECVERR == cm->cmsg_type)
+										|| (SOL_IPV6 == cm->cmsg_level && IPV6_RECVERR == cm->cmsg_type);
+					if (!is_recverr)
+						continue;
+
+					struct sock_extended_err const *serr = (struct sock_extended_err const*)CMSG_DATA(cm);
+					if (0 != serr->ee_errno || SO_EE_ORIGIN_ZEROCOPY != serr->ee_origin)
+						continue;
+
+					uint32_t const lo = serr->ee_info;
+					uint32_t const hi = serr->ee_data;
+
+					zc_stats.completions += (hi - lo + 1);
+					if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+						zc_stats.copied += (hi - lo + 1);
+
+					zc_early.push_back(std::make_pair(lo, hi));
+				}
+			}
+
+			// advance done_id over contiguous completed ranges, tcp reports them in order, but that's not promised
+			for (bool advanced = true; advanced; /**/)
+			{
+				advanced = false;
+				for (size_t i = 0; i < zc_early.size(); ++i)
+				{
+					std::pair<uint32_t, uint32_t> const r = zc_early[i];
+					if ((int32_t)(r.first - zc_done_id) > 0)
+						continue;
+
+					if ((int32_t)(r.second + 1 - zc_done_id) > 0)
+						zc_done_id = r.second + 1;
+
+					zc_early[i] = zc_early.back();
+					zc_early.pop_back();
+					advanced = true;
+					break;
+				}
+			}
+
+			while (!zc_pending.empty() && (int32_t)(zc_pending.front().id - zc_done_id) < 0)
+				zc_pending.pop_front();
+		}
+	};
+
+	// zerocopy sends of a connection that is gone, but the kernel hasn't completed them yet
+	//  the pages can still be (re)transmitted, so the buffers can't be freed (and reused from their pool) till then
+	//  the socket is shut down for writes (the peer sees the close as usual) and kept open to get the completions
+	//  these are polled on a timer, the socket itself is readable till the peer closes and then forever
+	//  when all are done the socket is closed and the buffers are freed
+	struct generic_connection_zerocopy_linger_t : private boost::noncopyable
+	{
+		static ev_tstamp poll_interval() { return 0.02; }
+
+		// takes the fd out of io_ctx, if there is anything to wait for
+		static void on_close(evloop_t *loop, io_context_t& io_ctx, buffer_chain_t& wchain, generic_connection_zerocopy_context_t& zc)
+		{
+			if (generic_connection_zerocopy_context_t::zc_enabled != zc.zc_state || !io_ctx.is_valid())
+				return;
+
+			// partially sent head of the chain is referenced as well
+			if (zc.zc_front_touched)
+			{
+				zc.zc_pending.push_back(generic_connection_zerocopy_context_t::zc_pending_t { zc.zc_front_id, wchain.grab_front() });
+				zc.zc_front_touched = false;
+			}
+
+			zc.zc_reap(io_ctx.fd());
+			if (!zc.zc_pending.empty())
+				linger(loop, io_ctx.release_fd(), zc);
+
+			// send ids are per socket, the context might get another one
+			zc.zc_state   = generic_connection_zerocopy_context_t::zc_unknown;
+			zc.zc_next_id = 0;
+			zc.zc_done_id = 0;
+			zc.zc_early.clear();
+			zc.zc_pending.clear();
+		}
+
+	private:
+
+		static void linger(evloop_t *loop, int fd, generic_connection_zerocopy_context_t& zc)
+		{
+			::shutdown(fd, SHUT_WR);
+
+			// nowhere to wait, the memory is never reused then
+			if (NULL == loop)
+			{
+				for (auto& p : zc.zc_pending)
+					p.buf.release();
+
+				::close(fd);
+				return;
+			}
+
+			auto *self = new generic_connection_zerocopy_linger_t(loop, fd, zc);
+			ev_timer_start(loop, &self->timer_);
+			ev_unref(loop); // doesn't keep the loop running
+		}
+
+	private:
+
+		generic_connection_zerocopy_linger_t(evloop_t *loop, int fd, generic_connection_zerocopy_context_t& zc)
+			: loop_(loop)
+			, fd_(fd)
+		{
+			zc_.zc_done_id = zc.zc_done_id;
+			zc_.zc_pending.swap(zc.zc_pending);
+			zc_.zc_early.swap(zc.zc_early);
+
+			ev_timer_init(&timer_, &timer_cb, poll_interval(), poll_interval());
+			timer_.data = this;
+		}
+
+		static void timer_cb(evloop_t *loop, evtimer_t *ev, int revents)
+		{
+			auto *self = static_cast<generic_connection_zerocopy_linger_t*>(ev->data);
+
+			self->zc_.zc_reap(self->fd_);
+			if (!self->zc_.zc_pending.empty())
+				return;
+
+			ev_ref(loop);
+			ev_timer_stop(loop, ev);
+			::close(self->fd_);
+			delete self;
+		}
+
+	private:
+		evloop_t                              *loop_;
+		int                                    fd_;
+		evtimer_t                              timer_;
+		generic_connection_zerocopy_context_t  zc_;
+	};
+
+	template<class Traits>
+	struct generic_connection_zerocopy_traits
+	{
+		struct option_write_zerocopy_threshold_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_write_zerocopy_threshold, option_write_zerocopy_threshold_default);
+
+		enum { threshold = option_write_zerocopy_threshold::value };
+
+		struct empty_context_t {};
+		typedef typename std::conditional<
+							  (threshold > 0)
+							, generic_connection_zerocopy_context_t
+							, empty_context_t
+							>::type context_t;
+	};
+
 	template<class Traits>
 	struct generic_connection_traits__base
 	{
@@ -77,35 +608,104 @@ namespace meow { namespace libev {
 		typedef typename BaseTraits::orig_traits orig_traits;
 		typedef typename generic_connection_logging_traits<orig_traits>::log_writer log_writer;
 
+		typedef generic_connection_zerocopy_traits<orig_traits> tr_zerocopy;
+		typedef typename generic_connection_io_stats_traits<orig_traits>::io_stats_collector tr_io_stats;
+
+		// limits for a single writev() call, segments are capped at IOV_MAX anyway
+		//  struct option_writev_max_bufs { enum { value = 64 }; };          // default: IOV_MAX
+		//  struct option_writev_max_bytes { enum { value = 256 * 1024 }; }; // default: 0 == unlimited
+		struct option_writev_max_bufs_default { enum { value = IOV_MAX }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(orig_traits, option_writev_max_bufs, option_writev_max_bufs_default);
+
+		struct option_writev_max_bytes_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(orig_traits, option_writev_max_bytes, option_writev_max_bytes_default);
+
+		enum
+		{
+			writev_max_bufs  = (option_writev_max_bufs::value < IOV_MAX) ? option_writev_max_bufs::value : IOV_MAX,
+			writev_max_bytes = option_writev_max_bytes::value,
+		};
+		static_assert(writev_max_bufs > 0, "option_writev_max_bufs must be positive");
+
+		// max_bytes is the write budget for this call, 0 == unlimited
+		//  when it's exhausted with data still in the chain, 'yield' is returned
 		template<class ContextT>
-		static wr_complete_status_t writev_bufs(ContextT *ctx)
+		static wr_complete_status_t writev_bufs(ContextT *ctx, size_t max_bytes = 0)
 		{
-			return writev_from_wchain(ctx, ctx->wchain_);
+			wr_complete_status_t const wr = writev_bufs_impl(ctx, max_bytes, std::integral_constant<bool, (tr_zerocopy::threshold > 0)>());
+			if (wr_complete_status::finished == wr)
+				tr_io_stats::on_flushed(ctx);
+			return wr;
 		}
 
+	private:
+
 		template<class ContextT>
-		static wr_complete_status_t writev_from_wchain(ContextT *ctx, buffer_chain_t& wchain)
+		static wr_complete_status_t writev_bufs_impl(ContextT *ctx, size_t max_bytes, std::false_type)
 		{
-			io_context_t *io_ctx = BaseTraits::io_context_ptr(ctx);
+			return writev_from_wchain(ctx, ctx->wchain_, max_bytes);
+		}
+
+		template<class ContextT>
+		static wr_complete_status_t writev_bufs_impl(ContextT *ctx, size_t max_bytes, std::true_type)
+		{
+			return writev_zerocopy(ctx, max_bytes);
+		}
+
+	public:
+
+		template<class ContextT>
+		static wr_complete_status_t writev_from_wchain(ContextT *ctx, buffer_chain_t& wchain, size_t max_bytes = 0)
+		{
+			size_t budget_left = (max_bytes) ? max_bytes : SIZE_MAX;
 
 			IO_LOG_WRITE(ctx, line_mode::single, "{0}; ctx: {1}, wsz: {2}"
-					, __func__, ctx, wchain.size() /* linear complexity, but usually very short */);
+					, __func__, ctx, wchain.size());
 
-			if (wchain.empty())
-				return wr_complete_status::finished;
+			while (!wchain.empty())
+			{
+				if (0 == budget_left)
+					return wr_complete_status::yield;
+
+				wr_complete_status_t const wr = writev_chain_front(ctx, wchain, budget_left);
+				if (wr_complete_status::finished != wr)
+					return wr;
+			}
+
+			return wr_complete_status::finished;
+		}
+
+	private:
+
+		// memory buffers from the head of the chain up to the next file region, or that file region itself
+		//  'finished' means the rest of the chain (if any) can be written next
+		template<class ContextT>
+		static wr_complete_status_t writev_chain_front(ContextT *ctx, buffer_chain_t& wchain, size_t& budget_left)
+		{
+			buffer_t *b = wchain.front();
+			return (0 == b->used_size() && NULL != b->file_region())
+					? write_file_region(ctx, wchain, budget_left)
+					: writev_memory(ctx, wchain, budget_left)
+					;
+		}
 
-			// check for just 1 buffer in the chain
+		template<class ContextT>
+		static wr_complete_status_t writev_memory(ContextT *ctx, buffer_chain_t& wchain, size_t& budget_left)
+		{
+			io_context_t *io_ctx = BaseTraits::io_context_ptr(ctx);
+
+			// check for just 1 buffer in the chain (or a file region right after the first one)
 			//  if that - use plain write() syscall
-			if (wchain.end() == ++wchain.begin())
+			if (NULL != wchain.front()->file_region() || wchain.end() == ++wchain.begin())
 			{
 				buffer_t *b = wchain.front();
 
 				size_t offset = 0;
 				size_t const total_size = b->used_size();
 
-				while (offset < total_size)
+				while (offset < total_size && budget_left > 0)
 				{
-					size_t const wr_size = total_size - offset;
+					size_t const wr_size = std::min(total_size - offset, budget_left);
 
 					IO_LOG_WRITE(ctx, line_mode::prefix
 							, "::write({0}, {1} + {2}, {3} = {4} - {5}) = "
@@ -114,6 +714,7 @@ namespace meow { namespace libev {
 							);
 
 					ssize_t const n = ::write(io_ctx->fd(), b->first + offset, wr_size);
+					tr_io_stats::on_write(ctx, n, wr_size, (-1 == n) ? errno : 0);
 
 					if (-1 == n)
 					{
@@ -136,68 +737,103 @@ namespace meow { namespace libev {
 						}
 
 						offset += n;
+						budget_left -= n;
 						ctx->io_stats.bytes_written += n;
 					}
 				}
 
 				b->advance_first(offset);
 
-				if (!b->empty())
-					return wr_complete_status::more;
+				if (0 != b->used_size())
+					return (0 == budget_left) ? wr_complete_status::yield : wr_complete_status::more;
 
-				wchain.pop_front();
+				// file region of this buffer is written next
+				if (b->empty())
+					wchain.pop_front();
 				return wr_complete_status::finished;
 			}
 
-			static size_t const writev_max_bufs = 8;
+			// iovecs are gathered into [iov_head, iov_tail) in chain order, iov[iov_head] is always wchain.front()
+			//  written ones are dropped by moving iov_head forward, more are appended at iov_tail
+			//  and the window starts over from the beginning only when it's been fully written, so nothing is ever moved
 			struct iovec iov[writev_max_bufs];
-
-			struct iovec *bufs = iov;
-			size_t n_bufs = 0;
+			size_t iov_head = 0;
+			size_t iov_tail = 0;
 
 			// this iterator is moved along the chain
 			//  and always points to the first buffer we don't have in iov yet
 			// NOTE: wchain is getting changed while writing, so care needs to be taken to not make iterator invalid
 			buffer_chain_t::iterator b_i = wchain.begin();
 
-			while (n_bufs > 0 || !wchain.empty())
+			// the last gathered buffer has a file region, that is written with another syscall
+			bool region_next = false;
+
+			while (!wchain.empty())
 			{
-				// move the data to the beginning
-				//  as we need to make some space at end to insert more data
-				if (bufs != iov)
+				if (iov_head == iov_tail)
 				{
-					std::memmove(iov, bufs, n_bufs * sizeof(iov[0]));
-					bufs = iov;
+					if (region_next)
+						return wr_complete_status::finished;
+
+					iov_head = iov_tail = 0;
 				}
 
 				// fill up iovec as much as we can from the last known position
-				while (n_bufs < writev_max_bufs && b_i != wchain.end())
+				while (iov_tail < writev_max_bufs && b_i != wchain.end() && !region_next)
 				{
 					buffer_t *b = *b_i;
 
-					bufs[n_bufs].iov_base = b->first;
-					bufs[n_bufs].iov_len = b->used_size();
+					region_next = (NULL != b->file_region());
+					if (region_next && 0 == b->used_size())
+						break;
+
+					iov[iov_tail].iov_base = b->first;
+					iov[iov_tail].iov_len = b->used_size();
 
 					++b_i;
-					++n_bufs;
+					++iov_tail;
 				}
 
-				IO_LOG_WRITE(ctx, line_mode::prefix, "::writev({0}, {1} : ", io_ctx->fd(), n_bufs);
+				// cut the iovec at the budget or per-call limit, cut length is restored right after the syscall
+				size_t const call_limit = (writev_max_bytes > 0) ? std::min(budget_left, (size_t)writev_max_bytes) : budget_left;
+
+				struct iovec *bufs = iov + iov_head;
+				size_t n_wr_bufs = iov_tail - iov_head;
+				struct iovec *cut_v = NULL;
+				size_t cut_len = 0;
 
 				size_t total_len = 0;
-				for (size_t i = 0; i < n_bufs; ++i)
+				for (size_t i = 0; i < n_wr_bufs; ++i)
 				{
 					struct iovec *v = bufs + i;
+					if (total_len + v->iov_len > call_limit)
+					{
+						cut_v = v;
+						cut_len = v->iov_len;
+						v->iov_len = call_limit - total_len;
+						total_len = call_limit;
+						n_wr_bufs = i + 1;
+						break;
+					}
 					total_len += v->iov_len;
+				}
 
+				IO_LOG_WRITE(ctx, line_mode::prefix, "::writev({0}, {1} : ", io_ctx->fd(), n_wr_bufs);
+
+				for (size_t i = 0; i < n_wr_bufs; ++i)
+				{
 					IO_LOG_WRITE(ctx, line_mode::middle, "{2}{{ {0}, {1} }"
-							, v->iov_base, v->iov_len
+							, bufs[i].iov_base, bufs[i].iov_len
 							, ((i > 0) ? ", " : "")
 							);
 				}
 
 				IO_LOG_WRITE(ctx, line_mode::middle, ", {0}) = ", total_len);
-				ssize_t n = ::writev(io_ctx->fd(), bufs, n_bufs);
+				ssize_t n = ::writev(io_ctx->fd(), bufs, n_wr_bufs);
+				tr_io_stats::on_write(ctx, n, total_len, (-1 == n) ? errno : 0);
+				if (NULL != cut_v)
+					cut_v->iov_len = cut_len;
+
 				if (n >= 0)
 					IO_LOG_WRITE(ctx, line_mode::suffix, "{0}", n);
 				else
@@ -224,35 +860,355 @@ namespace meow { namespace libev {
 					ctx->io_stats.bytes_written += n;
 
 					size_t len = n;
-					while (len > 0 && len >= bufs->iov_len)
+					while (len > 0 && len >= iov[iov_head].iov_len)
 					{
-						len -= bufs->iov_len;
-						bufs++;
+						len -= iov[iov_head].iov_len;
 
 						// we assume that writev() never returns more than all the buffers
-						//  could hold, so n_bufs can't underflow here
-						assert(n_bufs > 0);
-						n_bufs--;
+						//  could hold, so iov_head can't run past iov_tail here
+						assert(iov_head < iov_tail);
+						iov_head++;
 
-						// buf fully written
-						wchain.pop_front();
+						// buf fully written, its memory part at least
+						buffer_t *b = wchain.front();
+						if (NULL == b->file_region())
+							wchain.pop_front();
+						else
+							b->clear();
 					}
 
 					if (len > 0)
 					{
-						bufs->iov_base = (char*)bufs->iov_base + len;
-						bufs->iov_len -= len;
+						iov[iov_head].iov_base = (char*)iov[iov_head].iov_base + len;
+						iov[iov_head].iov_len -= len;
 
 						// partial write, adjust anyway, might not have the chance later
 						buffer_t *b = wchain.front();
 						b->advance_first(len);
 					}
+
+					budget_left -= n;
+					if (0 == budget_left && !wchain.empty())
+						return wr_complete_status::yield;
+
+					// short write on a nonblocking stream socket == send buffer is full
+					//  the next writev() is going to get EAGAIN, don't waste a syscall on that
+					if ((size_t)n < total_len)
+						return wr_complete_status::more;
 					break;
 				} // switch
 			} // while
 
 			return wr_complete_status::finished;
 		}
+
+		template<class ContextT>
+		static wr_complete_status_t write_file_region(ContextT *ctx, buffer_chain_t& wchain, size_t& budget_left)
+		{
+			io_context_t *io_ctx = BaseTraits::io_context_ptr(ctx);
+			buffer_file_region_t *r = wchain.front()->file_region();
+
+			while (r->length > 0)
+			{
+				if (0 == budget_left)
+					return wr_complete_status::yield;
+
+				size_t wr_size = std::min(r->length, budget_left);
+				if (writev_max_bytes > 0)
+					wr_size = std::min(wr_size, (size_t)writev_max_bytes);
+
+				IO_LOG_WRITE(ctx, line_mode::prefix, "::{0}({1}, {2}, {3}, {4}) = "
+						, (r->is_pipe ? "splice" : "sendfile"), io_ctx->fd(), r->fd, r->offset, wr_size);
+
+				ssize_t const n = (r->is_pipe)
+						? ::splice(r->fd, NULL, io_ctx->fd(), NULL, wr_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK)
+						: ::sendfile(io_ctx->fd(), r->fd, &r->offset, wr_size)
+						;
+				tr_io_stats::on_write(ctx, n, wr_size, (-1 == n) ? errno : 0);
+
+				if (-1 == n)
+				{
+					IO_LOG_WRITE(ctx, line_mode::suffix, "{0}, errno: {1} : {2}", n, errno, strerror(errno));
+
+					if (EAGAIN == errno || EWOULDBLOCK == errno)
+						return wr_complete_status::more;
+
+					ctx->cb_write_closed(io_close_report(io_close_reason::io_error, errno));
+					return wr_complete_status::closed;
+				}
+
+				IO_LOG_WRITE(ctx, line_mode::suffix, "{0}", n);
+
+				// the file has ended before the region did
+				if (0 == n)
+				{
+					ctx->cb_write_closed(io_close_report(io_close_reason::io_error, EIO));
+					return wr_complete_status::closed;
+				}
+
+				r->length -= n;
+				budget_left -= n;
+				ctx->io_stats.bytes_written += n;
+
+				// socket buffer is full, same as with writev()
+				if ((size_t)n < wr_size)
+					return wr_complete_status::more;
+			}
+
+			wchain.pop_front();
+			return wr_complete_status::finished;
+		}
+
+	public: // MSG_ZEROCOPY
+
+		template<class ContextT>
+		static wr_complete_status_t writev_zerocopy(ContextT *ctx, size_t max_bytes)
+		{
+			io_context_t *io_ctx = BaseTraits::io_context_ptr(ctx);
+			buffer_chain_t& wchain = ctx->wchain_;
+
+			// every fd wakeup gets here (the machine writes on all of them), a non-empty error queue keeps the fd reporting
+			if (generic_connection_zerocopy_context_t::zc_enabled == ctx->zc_state)
+				zerocopy_reap(ctx);
+
+			if (generic_connection_zerocopy_context_t::zc_unknown == ctx->zc_state)
+			{
+				int const on = 1;
+				ctx->zc_state = (0 == ::setsockopt(io_ctx->fd(), SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+								? generic_connection_zerocopy_context_t::zc_enabled
+								: generic_connection_zerocopy_context_t::zc_unsupported
+								;
+			}
+
+			if (generic_connection_zerocopy_context_t::zc_enabled != ctx->zc_state)
+				return writev_from_wchain(ctx, wchain, max_bytes);
+
+			size_t budget_left = (max_bytes) ? max_bytes : SIZE_MAX;
+
+			while (!wchain.empty())
+			{
+				if (0 == budget_left)
+					return wr_complete_status::yield;
+
+				// buffers with file regions are written without zerocopy, they are never gathered below
+				if (NULL != wchain.front()->file_region())
+				{
+					wr_complete_status_t const wr = writev_chain_front(ctx, wchain, budget_left);
+					if (wr_complete_status::finished != wr)
+						return wr;
+					continue;
+				}
+
+				struct iovec iov[writev_max_bufs];
+				size_t n_bufs = 0;
+				size_t total_len = 0;
+
+				size_t const call_limit = (writev_max_bytes > 0) ? std::min(budget_left, (size_t)writev_max_bytes) : budget_left;
+
+				for (buffer_chain_t::iterator b_i = wchain.begin(); n_bufs < writev_max_bufs && b_i != wchain.end(); ++b_i)
+				{
+					buffer_t *b = *b_i;
+					if (NULL != b->file_region())
+						break;
+
+					size_t const len = std::min(b->used_size(), call_limit - total_len);
+
+					iov[n_bufs].iov_base = b->first;
+					iov[n_bufs].iov_len = len;
+					++n_bufs;
+
+					total_len += len;
+					if (total_len == call_limit)
+						break;
+				}
+
+				struct msghdr msg = {};
+				msg.msg_iov = iov;
+				msg.msg_iovlen = n_bufs;
+
+				bool zerocopy = (total_len >= (size_t)tr_zerocopy::threshold);
+
+				ssize_t n = ::sendmsg(io_ctx->fd(), &msg, (zerocopy) ? MSG_ZEROCOPY : 0);
+				tr_io_stats::on_write(ctx, n, total_len, (-1 == n) ? errno : 0);
+				if (-1 == n && zerocopy && ENOBUFS == errno)
+				{
+					ctx->zc_stats.fallbacks++;
+					zerocopy = false;
+					n = ::sendmsg(io_ctx->fd(), &msg, 0);
+					tr_io_stats::on_write(ctx, n, total_len, (-1 == n) ? errno : 0);
+				}
+
+				IO_LOG_WRITE(ctx, line_mode::single, "::sendmsg({0}, {1} : {2}, zc: {3}) = {4}"
+						, io_ctx->fd(), n_bufs, total_len, zerocopy, n);
+
+				if (-1 == n)
+				{
+					if (EAGAIN == errno || EWOULDBLOCK == errno)
+						return wr_complete_status::more;
+
+					ctx->cb_write_closed(io_close_report(io_close_reason::io_error, errno));
+					return wr_complete_status::closed;
+				}
+
+				if (0 == n)
+				{
+					ctx->cb_write_closed(io_close_report(io_close_reason::peer_close));
+					return wr_complete_status::closed;
+				}
+
+				ctx->io_stats.bytes_written += n;
+				budget_left -= n;
+
+				uint32_t const id = (zerocopy) ? ctx->zc_next_id++ : 0;
+				if (zerocopy)
+				{
+					ctx->zc_stats.sends++;
+					ctx->zc_stats.bytes += n;
+				}
+
+				// written buffers that zerocopy sends have referenced, go to pending
+				size_t len = n;
+				while (len > 0)
+				{
+					buffer_t *b = wchain.front();
+					size_t const b_len = b->used_size();
+
+					if (len < b_len)
+					{
+						b->advance_first(len);
+
+						if (zerocopy)
+						{
+							ctx->zc_front_touched = true;
+							ctx->zc_front_id = id;
+						}
+						break;
+					}
+
+					len -= b_len;
+
+					buffer_move_ptr done = wchain.grab_front();
+					if (zerocopy || ctx->zc_front_touched)
+					{
+						uint32_t const done_id = (zerocopy) ? id : ctx->zc_front_id;
+						ctx->zc_pending.push_back(generic_connection_zerocopy_context_t::zc_pending_t { done_id, move(done) });
+					}
+					ctx->zc_front_touched = false;
+				}
+			}
+
+			return wr_complete_status::finished;
+		}
+
+		template<class ContextT>
+		static void zerocopy_reap(ContextT *ctx)
+		{
+			ctx->zc_reap(BaseTraits::io_context_ptr(ctx)->fd());
+		}
+
+	public: // completion based engines, they do the io themselves
+
+		// file regions are read into memory of their buffers in pieces of this size, there is no sendfile() to submit
+		static size_t const file_region_bounce_size = 64 * 1024;
+
+		// gather up to iov_max buffers from the head of the chain, up to and including the first one with a file region
+		//  does not modify the chain, except for reading the next piece of a file region at its head
+		//  returns -1 if that has failed and the connection has been closed
+		template<class ContextT>
+		static ssize_t writev_prepare(ContextT *ctx, struct iovec *iov, size_t iov_max)
+		{
+			buffer_chain_t& wchain = ctx->wchain_;
+
+			if (!wchain.empty())
+			{
+				buffer_t *b = wchain.front();
+				if (0 == b->used_size() && !b->empty())
+				{
+					ssize_t const n = buffer_file_region_fill(*b, file_region_bounce_size);
+
+					IO_LOG_WRITE(ctx, line_mode::single, "{0}; ctx: {1}, file region fill: {2}", __func__, ctx, n);
+
+					if (n <= 0)
+					{
+						ctx->cb_write_closed(io_close_report(io_close_reason::io_error, (0 == n) ? EIO : errno));
+						return -1;
+					}
+				}
+			}
+
+			size_t n_bufs = 0;
+			for (buffer_chain_t::iterator b_i = wchain.begin(); n_bufs < iov_max && b_i != wchain.end(); ++b_i)
+			{
+				buffer_t *b = *b_i;
+
+				bool const region_next = (NULL != b->file_region());
+				if (region_next && 0 == b->used_size())
+					break;
+
+				iov[n_bufs].iov_base = b->first;
+				iov[n_bufs].iov_len = b->used_size();
+				++n_bufs;
+
+				if (region_next)
+					break;
+			}
+
+			return n_bufs;
+		}
+
+		// n bytes of requested (total length of the iovecs submitted) from the buffers given out by writev_prepare() have been written
+		//  or n == -1 and err_code is the reason
+		template<class ContextT>
+		static wr_complete_status_t writev_complete(ContextT *ctx, ssize_t n, size_t requested, int err_code)
+		{
+			buffer_chain_t& wchain = ctx->wchain_;
+
+			IO_LOG_WRITE(ctx, line_mode::single, "{0}; ctx: {1}, n: {2}, err: {3}", __func__, ctx, n, err_code);
+
+			tr_io_stats::on_write(ctx, n, requested, err_code);
+
+			if (-1 == n)
+			{
+				ctx->cb_write_closed(io_close_report(io_close_reason::io_error, err_code));
+				return wr_complete_status::closed;
+			}
+
+			if (0 == n)
+			{
+				ctx->cb_write_closed(io_close_report(io_close_reason::peer_close));
+				return wr_complete_status::closed;
+			}
+
+			ctx->io_stats.bytes_written += n;
+
+			size_t len = n;
+			while (len > 0)
+			{
+				buffer_t *b = wchain.front();
+				size_t const b_len = b->used_size();
+
+				if (len < b_len)
+				{
+					b->advance_first(len);
+					break;
+				}
+
+				len -= b_len;
+
+				// memory part is done, file region might be still left
+				b->advance_first(b_len);
+				if (!b->empty())
+					break;
+
+				wchain.pop_front();
+			}
+
+			if (!wchain.empty())
+				return wr_complete_status::more;
+
+			tr_io_stats::on_flushed(ctx);
+			return wr_complete_status::finished;
+		}
 	};
 
 	template<class Traits>
@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__HIERARCHICAL_TIMER_IMPL_HPP_
+#define MEOW_LIBEV__HIERARCHICAL_TIMER_IMPL_HPP_
+
+#include <array>
+#include <cstdint>
+#include <functional> // bind
+
+#include <meow/libev/bounded_timer.hpp>
+#include <meow/libev/libev.hpp>
+#include <meow/libev/ticker.hpp>
+#include <meow/unix/time.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// hashed hierarchical timing wheel, same interface as bounded_timer_impl_t
+	//  n_levels wheels of 2^level_bits lists each, a level covers 2^level_bits times the range of the one below
+	//  defaults: 1ms ticks, 4 levels of 256 -> 2^32 ticks (~49 days) in 1024 lists
+	//
+	// a timer goes to the lowest level that covers its distance from now, set and del are O(1)
+	// timers move down a level only when the wheel gets to their slot (cascade)
+	//  so a timer deleted or reset before that (i.e. most of the idle timeouts) is never moved
+	//
+	// ticks are counted from the loop time, not from ticker callbacks
+	//  if the loop stalls, all the ticks missed are processed on the next callback, in order
+	//  timers set during a stall are relative to the loop time, not to the last processed tick
+	//
+	// timeouts longer than the wheel are clamped to the longest one
+	template<
+		  size_t tick_interval_ms = 1
+		, size_t level_bits = 8
+		, size_t n_levels = 4
+	>
+	struct hierarchical_timer_impl_t : public bounded_timer_t
+	{
+		typedef bounded_timer_t            base_t;
+		typedef hierarchical_timer_impl_t  self_t;
+
+		typedef typename base_t::node_t       node_t;
+		typedef typename base_t::timestamp_t  timestamp_t;
+
+		typedef boost::intrusive::list<
+					  node_t
+					, boost::intrusive::base_hook<node_hook_t>
+					, boost::intrusive::constant_time_size<false>
+					> timer_list_t;
+
+		static_assert(level_bits * n_levels < 64, "tick counter would overflow");
+
+		enum : uint64_t {
+			  slots_per_level = uint64_t(1) << level_bits
+			, slot_mask = slots_per_level - 1
+			, max_timeout = (uint64_t(1) << (level_bits * n_levels)) - 1
+			, tick_interval = tick_interval_ms
+		};
+
+		typedef std::array<std::array<timer_list_t, slots_per_level>, n_levels> holder_t;
+
+	public:
+
+		hierarchical_timer_impl_t(evloop_t *loop)
+			: current_tick_(0)
+			, start_time_(ev_now(loop))
+			, ticker_(loop)
+		{
+			auto const tv = timeval_t {
+				.tv_sec = tick_interval_ms / msec_in_sec,
+				.tv_nsec = (tick_interval_ms % msec_in_sec) * (nsec_in_sec / msec_in_sec),
+			};
+
+			ticker_.start(tv, std::bind(&self_t::on_tick, this, std::placeholders::_1, std::placeholders::_2));
+		}
+
+		~hierarchical_timer_impl_t()
+		{
+			this->shutdown();
+		}
+
+		void shutdown()
+		{
+			ticker_.stop();
+		}
+
+	public:
+
+		virtual evloop_t* loop() const { return ticker_.loop(); }
+
+		virtual size_t tick_interval_msec() const { return tick_interval_ms; }
+		virtual size_t max_timeout_intervals() const { return max_timeout; }
+
+		virtual void timer_set(node_t *node, timestamp_t ts)
+		{
+			uint64_t offset = make_offset_from_timestamp(ts);
+
+			// zero is a special value, meaning 'next tick'
+			if (0 == offset)
+				offset = 1;
+
+			// from the loop time, the wheel might be behind it if the loop has stalled
+			uint64_t const now_tick = std::max(current_tick_, this->tick_at(ev_now(this->loop())));
+			uint64_t const expires = std::min(now_tick + offset, current_tick_ + max_timeout);
+
+			if (node->is_linked())
+				node->unlink();
+
+			node->timer_expires_tick = expires;
+			this->insert(node);
+		}
+
+		virtual void timer_del(node_t *node)
+		{
+			if (node->is_linked())
+				node->unlink();
+		}
+
+	private:
+
+		static inline uint64_t make_offset_from_timestamp(timestamp_t ts)
+		{
+			timeval_t const tv = timeval_from_double(ts);
+			uint64_t const msec = tv.tv_sec * msec_in_sec + tv.tv_nsec / (nsec_in_sec / msec_in_sec);
+
+			return msec / tick_interval_ms;
+		}
+
+		uint64_t tick_at(ev_tstamp now) const
+		{
+			ev_tstamp const elapsed = now - start_time_;
+			return (elapsed > 0) ? uint64_t(elapsed * msec_in_sec / tick_interval_ms) : 0;
+		}
+
+		// the lowest level that covers the distance, at the slot of the expiry digit on that level
+		//  expiring right now (only happens when cascading) goes to the current level 0 slot, processed next
+		void insert(node_t *node)
+		{
+			uint64_t const expires = node->timer_expires_tick;
+			uint64_t const delta = (expires > current_tick_) ? (expires - current_tick_) : 0;
+
+			size_t level = 0;
+			while (level < n_levels - 1 && delta >= (uint64_t(1) << (level_bits * (level + 1))))
+				++level;
+
+			uint64_t const tick = (0 == delta) ? current_tick_ : expires;
+			l_[level][(tick >> (level_bits * level)) & slot_mask].push_back(*node);
+		}
+
+		// moves timers from a slot down to the lower levels
+		void cascade(size_t level)
+		{
+			timer_list_t l;
+			l.swap(l_[level][(current_tick_ >> (level_bits * level)) & slot_mask]);
+
+			while (!l.empty())
+			{
+				node_t *node = &l.front();
+				l.pop_front();
+				this->insert(node);
+			}
+		}
+
+		void advance_one_tick(ev_tstamp now)
+		{
+			++current_tick_;
+
+			// the highest level this tick is a boundary of, cascade from there down
+			//  so that timers cascaded from above are cascaded again to where they belong
+			size_t top = 0;
+			while (top < n_levels - 1 && 0 == (current_tick_ & ((uint64_t(1) << (level_bits * (top + 1))) - 1)))
+				++top;
+
+			for (size_t level = top; level > 0; --level)
+				this->cascade(level);
+
+			timer_list_t& l = l_[0][current_tick_ & slot_mask];
+			while (!l.empty())
+			{
+				node_t *node = &l.front();
+				l.pop_front();
+
+				node->timer_callback(this, node, now);
+			}
+		}
+
+		void on_tick(ticker_t*, double now)
+		{
+			uint64_t const target_tick = this->tick_at(now);
+
+			// at least one, the ticker might fire a bit before the loop time gets to the next tick
+			do {
+				this->advance_one_tick(now);
+			} while (current_tick_ < target_tick);
+		}
+
+	private:
+		uint64_t    current_tick_; // processed up to
+		ev_tstamp   start_time_;
+		ticker_t    ticker_;
+		holder_t    l_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__HIERARCHICAL_TIMER_IMPL_HPP_
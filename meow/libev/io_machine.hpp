@@ -51,6 +51,7 @@ namespace meow { namespace libev {
 									((more, 	"more"))
 									((finished, "finished"))
 									((closed, 	"closed"))
+									((yield, 	"yield"))
 									);
 
 	MEOW_DEFINE_SMART_ENUM_STRUCT(custom_op_status,
@@ -58,6 +59,15 @@ namespace meow { namespace libev {
 									((closed, 	"closed"))
 									);
 
+	// limits for a single run_loop() call, 0 == unlimited
+	struct io_budget_t
+	{
+		size_t read_ops;    // read syscalls
+		size_t read_bytes;
+		size_t write_bytes;
+		size_t custom_ops;
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #if 0 && IO_MACHINE_THIS_IS_AN_EXAMPLE_TRAITS_DEFINITIONS_YOU_CAN_USE
@@ -137,6 +147,18 @@ namespace meow { namespace libev {
 			static void write(context_t *ctx, line_mode_t lmode, char *fmt, ...) {}
 		};
 
+		struct budget // optional
+		{
+			// limits for this run, checked after every read step (so it can overshoot by one buffer)
+			//  write_bytes is passed to tr_write::writev_bufs(ctx, max_bytes), that returns 'yield' when it's hit
+			// DEFAULT: all unlimited
+			static io_budget_t get(context_t *ctx) {}
+
+			// ev_op (EV_READ, EV_WRITE or EV_CUSTOM) budget has been exhausted
+			//  the op is postponed till next loop iteration
+			static void on_exhausted(context_t *ctx, int ev_op) {}
+		};
+
 		struct activity_tracker // optional
 		{
 			// idle tracking init, called when context is prepared
@@ -304,6 +326,41 @@ namespace meow { namespace libev {
 		}
 	};
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<class ContextT, class Traits>
+	struct iomachine_budget_wrap_t
+	{
+		template<bool enabled, class Tr>
+		struct thunk_t;
+
+		template<class Tr> struct thunk_t<true, Tr>
+		{
+			static io_budget_t get(ContextT *ctx) { return Tr::get(ctx); }
+			static void on_exhausted(ContextT *ctx, int ev_op) { Tr::on_exhausted(ctx, ev_op); }
+
+			template<class Tw>
+			static wr_complete_status_t writev_bufs(ContextT *ctx, io_budget_t const& b) { return Tw::writev_bufs(ctx, b.write_bytes); }
+		};
+
+		template<class Tr> struct thunk_t<false, Tr>
+		{
+			static io_budget_t get(ContextT *ctx) { return io_budget_t(); }
+			static void on_exhausted(ContextT *ctx, int ev_op) {}
+
+			template<class Tw>
+			static wr_complete_status_t writev_bufs(ContextT *ctx, io_budget_t const&) { return Tw::writev_bufs(ctx); }
+		};
+
+		DEFINE_THUNK(budget);
+
+		static io_budget_t get(ContextT *ctx) { return thunk::get(ctx); }
+		static void on_exhausted(ContextT *ctx, int ev_op) { thunk::on_exhausted(ctx, ev_op); }
+
+		template<class Tw>
+		static wr_complete_status_t writev_bufs(ContextT *ctx, io_budget_t const& b) { return thunk::template writev_bufs<Tw>(ctx, b); }
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 	template<class ContextT, class Traits>
@@ -333,6 +390,86 @@ namespace meow { namespace libev {
 		static void on_activity(ContextT *ctx, int revents) { thunk::on_activity(ctx, revents); }
 	};
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// see meow/libev/io_stats.hpp, only reads are done here, writes are counted by write traits
+	template<class ContextT, class Traits>
+	struct iomachine_io_stats_wrap_t
+	{
+		template<bool enabled, class Tr>
+		struct thunk_t;
+
+		template<class Tr> struct thunk_t<true, Tr>
+		{
+			static void on_read(ContextT *ctx, ssize_t n, int err) { Tr::on_read(ctx, n, err); }
+		};
+
+		template<class Tr> struct thunk_t<false, Tr>
+		{
+			static void on_read(ContextT *ctx, ssize_t n, int err) {}
+		};
+
+		DEFINE_THUNK(io_stats_collector);
+
+		static void on_read(ContextT *ctx, ssize_t n, int err) { thunk::on_read(ctx, n, err); }
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// keeps EV_WRITE in the wait mask for a few wakeups after the writes are done
+	//  so that a connection blocking on writes often doesn't flip the backend mask (epoll_ctl()) back and forth
+	//  the price is a spurious wakeup per loop iteration while lingering, as the socket is writable
+	//
+	// traits need
+	//  enum { iterations = N };
+	//  static unsigned get(ContextT*);             // wakeups left to linger
+	//  static void     set(ContextT*, unsigned);
+	template<class ContextT, class Traits>
+	struct iomachine_write_linger_wrap_t
+	{
+		template<bool enabled, class Tr>
+		struct thunk_t;
+
+		template<class Tr> struct thunk_t<true, Tr>
+		{
+			static void adjust(ContextT *ctx, int curr_wait_ops, int io_executed_ops, int& io_wait_ops)
+			{
+				if (!BITMASK_TEST(io_executed_ops, EV_WRITE))
+					return;
+
+				// blocked, waiting for real
+				if (BITMASK_TEST(io_wait_ops, EV_WRITE))
+				{
+					Tr::set(ctx, Tr::iterations);
+					return;
+				}
+
+				// wasn't waiting, nothing to keep
+				if (!BITMASK_TEST(curr_wait_ops, EV_WRITE))
+					return;
+
+				unsigned const left = Tr::get(ctx);
+				if (0 == left)
+					return;
+
+				Tr::set(ctx, left - 1);
+				BITMASK_SET(io_wait_ops, EV_WRITE);
+			}
+		};
+
+		template<class Tr> struct thunk_t<false, Tr>
+		{
+			static void adjust(ContextT*, int, int, int&) {}
+		};
+
+		DEFINE_THUNK(write_linger);
+
+		static void adjust(ContextT *ctx, int curr_wait_ops, int io_executed_ops, int& io_wait_ops)
+		{
+			thunk::adjust(ctx, curr_wait_ops, io_executed_ops, io_wait_ops);
+		}
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
 #undef DEFINE_THUNK
@@ -356,7 +493,10 @@ namespace meow { namespace libev {
 		typedef iomachine_custom_op_wrap_t<ContextT, Traits> 			tr_custom_op;
 		typedef iomachine_read_precheck_wrap_t<ContextT, Traits>		tr_read_precheck;
 		typedef iomachine_log_writer_wrap_t<ContextT, Traits> 			tr_log;
+		typedef iomachine_budget_wrap_t<ContextT, Traits> 				tr_budget;
 		typedef iomachine_activity_tracker_wrap_t<ContextT, Traits> 	tr_activity;
+		typedef iomachine_io_stats_wrap_t<ContextT, Traits> 			tr_io_stats;
+		typedef iomachine_write_linger_wrap_t<ContextT, Traits> 		tr_write_linger;
 
 	private: // libev ops
 
@@ -408,6 +548,7 @@ namespace meow { namespace libev {
 				}
 
 				ssize_t n = ::read(fd, (char*)buf + curr_offset, buf_len - curr_offset);
+				tr_io_stats::on_read(ctx, n, (-1 == n) ? errno : 0);
 
 				if (tr_log::is_allowed(ctx))
 				{
@@ -531,6 +672,13 @@ namespace meow { namespace libev {
 			ev_io_set(ev, io_ctx->fd(), EV_NONE);
 		}
 
+		// as release_context(), but ctx is to be prepared again on another loop (see loop_detach())
+		//  readiness io has nothing in flight, so there is nothing to carry over
+		static void detach_context(context_t *ctx)
+		{
+			self_t::release_context(ctx);
+		}
+
 		static void activate_context(context_t *ctx, int io_requested_ops)
 		{
 			ev_feed_event(tr_base::ev_loop(ctx), tr_base::io_context_ptr(ctx)->event(), io_requested_ops);
@@ -569,6 +717,14 @@ namespace meow { namespace libev {
 			// operations we have actually executed, for idle notification
 			int io_activity_ops = EV_NONE;
 
+			// operations postponed till next loop iteration, as their budget is exhausted
+			int io_yield_ops = EV_NONE;
+
+			io_budget_t const budget = tr_budget::get(ctx);
+			size_t budget_read_ops = 0;
+			size_t budget_read_bytes = 0;
+			size_t budget_custom_ops = 0;
+
 			// we need this everywhere and it's cached for an iteration
 			//  might be a wrong thing to do tho, time will tell
 			io_context_t *io_ctx = tr_base::io_context_ptr(ctx);
@@ -594,8 +750,17 @@ namespace meow { namespace libev {
 							);
 				}
 
+				if (BITMASK_TEST(io_current_ops, EV_CUSTOM)
+					&& budget.custom_ops && (budget_custom_ops >= budget.custom_ops))
+				{
+					BITMASK_CLEAR(io_current_ops, EV_CUSTOM);
+					BITMASK_SET(io_yield_ops, EV_CUSTOM);
+					tr_budget::on_exhausted(ctx, EV_CUSTOM);
+				}
+
 				if (BITMASK_TEST(io_current_ops, EV_CUSTOM))
 				{
+					++budget_custom_ops;
 					custom_op_status_t c_status = tr_custom_op::custom_operation(ctx);
 					BITMASK_CLEAR(io_current_ops, EV_CUSTOM);
 
@@ -610,7 +775,7 @@ namespace meow { namespace libev {
 					}
 				}
 
-				while (BITMASK_TEST(io_current_ops, EV_READ)) // TODO: add iteration threshold here, via options prob
+				while (BITMASK_TEST(io_current_ops, EV_READ))
 				{
 					// peek if there is any data available at all
 					//  so that we don't allocate huge buffers needlessly
@@ -680,9 +845,23 @@ namespace meow { namespace libev {
 					}
 
 					io_activity_ops |= EV_READ;
+
+					// fairness: leave the rest for the next loop iteration
+					//  EV_READ stays in wait mask, so (level triggered) backend will report it again on next iteration
+					++budget_read_ops;
+					budget_read_bytes += r.filled_len;
+
+					if (BITMASK_TEST(io_current_ops, EV_READ)
+						&& ((budget.read_ops && budget_read_ops >= budget.read_ops)
+							|| (budget.read_bytes && budget_read_bytes >= budget.read_bytes)))
+					{
+						BITMASK_CLEAR(io_current_ops, EV_READ);
+						BITMASK_SET(io_wait_ops, EV_READ);
+						tr_budget::on_exhausted(ctx, EV_READ);
+					}
 				}
 
-				if (tr_custom_op::requires_custom_op(ctx))
+				if (!BITMASK_TEST(io_yield_ops, EV_CUSTOM) && tr_custom_op::requires_custom_op(ctx))
 				{
 					BITMASK_SET(io_current_ops, EV_CUSTOM);
 					continue;
@@ -691,7 +870,7 @@ namespace meow { namespace libev {
 				while (BITMASK_TEST(io_current_ops, EV_WRITE))
 				{
 //#if 0
-					wr_complete_status_t w_status = tr_write::writev_bufs(ctx);
+					wr_complete_status_t w_status = tr_budget::template writev_bufs<tr_write>(ctx, budget);
 
 					switch (w_status)
 					{
@@ -703,6 +882,11 @@ namespace meow { namespace libev {
 							BITMASK_CLEAR(io_current_ops, EV_WRITE);
 							BITMASK_SET(io_wait_ops, EV_WRITE);
 							break;
+						case wr_complete_status::yield: // budget exhausted, socket is (probably) still writable
+							BITMASK_CLEAR(io_current_ops, EV_WRITE);
+							BITMASK_SET(io_wait_ops, EV_WRITE);
+							tr_budget::on_exhausted(ctx, EV_WRITE);
+							break;
 						case wr_complete_status::closed: // fd has been closed
 							return;
 					}
@@ -762,7 +946,7 @@ namespace meow { namespace libev {
 #endif
 				}
 
-				if (tr_custom_op::requires_custom_op(ctx))
+				if (!BITMASK_TEST(io_yield_ops, EV_CUSTOM) && tr_custom_op::requires_custom_op(ctx))
 				{
 					BITMASK_SET(io_current_ops, EV_CUSTOM);
 					continue;
@@ -787,7 +971,12 @@ namespace meow { namespace libev {
 			//  bit limited only to the (io_requested_ops & io_allowed_ops)
 			//  so we need to only change those bits in new value for wait
 
-			int new_wait_ops = io_ctx->event()->events; 	// the initial mask is unchanged
+			// ev_io_set() leaves EV__IOFDSET in events till the watcher is started
+			int const curr_wait_ops = (io_ctx->event()->events & ~EV__IOFDSET);
+
+			tr_write_linger::adjust(ctx, curr_wait_ops, io_executed_ops, io_wait_ops);
+
+			int new_wait_ops = curr_wait_ops; 				// the initial mask is unchanged
 			BITMASK_CLEAR(new_wait_ops, io_executed_ops); 	// clear out masked space
 			BITMASK_SET(new_wait_ops, io_wait_ops); 		// set the new event bits
 
@@ -797,26 +986,51 @@ namespace meow { namespace libev {
 								, "{0}; << loop; fd: {1}; curr_ev_ops: 0x{2}, new_wait_ops = 0x{3}"
 								, __func__
 								, io_ctx->fd()
-								, meow::format::as_hex(io_ctx->event()->events)
+								, meow::format::as_hex(curr_wait_ops)
 								, meow::format::as_hex(new_wait_ops)
 								);
 			}
 
-			if (io_ctx->event()->events != new_wait_ops)
+			if (curr_wait_ops != new_wait_ops)
 			{
 				evloop_t *loop = tr_base::ev_loop(ctx);
 
 				ev_io_stop(loop, io_ctx->event());
 
+				// set the mask even if not restarting, stopped watcher must not look like it's waiting
+				//  or the same mask on next run would be taken for 'nothing changed'
+				ev_io_set(io_ctx->event(), io_ctx->fd(), new_wait_ops);
+
 				if (EV_NONE != new_wait_ops)
-				{
-					ev_io_set(io_ctx->event(), io_ctx->fd(), new_wait_ops);
 					ev_io_start(loop, io_ctx->event());
-				}
 			}
+
+			// custom ops have no fd readiness to bring us back, so ask explicitly
+			//  (read/write come back by themselves, as they're still in wait mask)
+			if (io_yield_ops)
+				self_t::activate_context(ctx, io_yield_ops);
 		}
 	};
 
+////////////////////////////////////////////////////////////////////////////////////////////////
+// execution engine, selected by connections via 'io_engine' traits typedef
+//  context_t: per-connection state the engine needs, connection inherits from it
+//  machine:   io_machine_t-compatible static interface
+//
+// this one is the default readiness based engine (libev io watcher + syscall per step)
+// see io_uring_machine.hpp for the completion based one
+
+	struct io_machine_engine_t
+	{
+		struct context_t {};
+
+		// read buffer is only used between get_buffer() and consume_buffer() of the same run
+		enum { buffers_in_flight = false };
+
+		template<class ContextT, class Traits>
+		struct machine { typedef io_machine_t<ContextT, Traits> type; };
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace meow { namespace libev {
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__IO_STATS_HPP_
+#define MEOW_LIBEV__IO_STATS_HPP_
+
+#include <sys/types.h> // ssize_t
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <type_traits>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// detailed io statistics of a connection (or all connections of a thread)
+	//  plain data, copy it out and feed to the metrics
+	//
+	// histograms are log2: bucket 0 counts zeroes, bucket i counts values in [2^(i-1), 2^i)
+	//  the last bucket takes everything larger
+	struct io_stats_snapshot_t
+	{
+		enum { size_buckets = 24, time_buckets = 36 };
+
+		uint64_t read_calls;
+		uint64_t read_bytes;
+		uint64_t read_eagain;
+
+		uint64_t write_calls;     // writev(), write(), sendfile() etc.
+		uint64_t write_bytes;
+		uint64_t write_eagain;
+		uint64_t write_short;     // wrote less than asked and no error
+
+		uint64_t read_size[size_buckets];  // bytes per read syscall that got data
+		uint64_t write_size[size_buckets]; // bytes per write syscall that wrote something
+
+		// from queueing into an empty write chain to that chain being fully written, nanoseconds
+		uint64_t flush_count;
+		uint64_t flush_ns_total;
+		uint64_t flush_time[time_buckets];
+
+		// inside read consume_buffer() callbacks, nanoseconds
+		uint64_t consume_count;
+		uint64_t consume_ns_total;
+		uint64_t consume_time[time_buckets];
+	};
+
+	inline size_t io_stats_bucket(uint64_t v, size_t n_buckets)
+	{
+		if (0 == v)
+			return 0;
+
+		size_t const b = 64 - __builtin_clzll(v);
+		return (b < n_buckets) ? b : n_buckets - 1;
+	}
+
+	inline void io_stats_add(io_stats_snapshot_t& to, io_stats_snapshot_t const& from)
+	{
+		uint64_t *t = (uint64_t*)&to;
+		uint64_t const *f = (uint64_t const*)&from;
+
+		for (size_t i = 0; i < sizeof(io_stats_snapshot_t) / sizeof(uint64_t); ++i)
+			t[i] += f[i];
+	}
+
+	// per-connection part, generic connection inherits from it when collector is enabled
+	struct io_stats_context_t
+	{
+		io_stats_snapshot_t io_stats_detail;
+		uint64_t            io_stats_flush_start_ns; // 0 when write chain is empty
+
+		io_stats_context_t()
+			: io_stats_detail()
+			, io_stats_flush_start_ns(0)
+		{
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// collectors, selected with
+//  typedef meow::libev::io_stats_collector_t io_stats_collector;
+// in connection traits, the default one does nothing and is compiled out
+
+	struct io_stats_collector_none_t
+	{
+		struct context_t {};
+
+		template<class ContextT> static void on_read(ContextT*, ssize_t, int) {}
+		template<class ContextT> static void on_write(ContextT*, ssize_t, size_t, int) {}
+		template<class ContextT> static void on_queue(ContextT*) {}
+		template<class ContextT> static void on_flushed(ContextT*) {}
+		template<class ContextT> static uint64_t consume_begin(ContextT*) { return 0; }
+		template<class ContextT> static void consume_end(ContextT*, uint64_t) {}
+	};
+
+	// updates both the connection stats and stats of the calling thread
+	//  the thread ones are the per-loop aggregate, as loops are run from a single thread
+	struct io_stats_collector_t
+	{
+		typedef io_stats_context_t context_t;
+
+		static io_stats_snapshot_t& this_thread()
+		{
+			static thread_local io_stats_snapshot_t s;
+			return s;
+		}
+
+		static uint64_t now_ns()
+		{
+			struct timespec ts;
+			::clock_gettime(CLOCK_MONOTONIC, &ts);
+			return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+		}
+
+		template<class ContextT>
+		static void on_read(ContextT *ctx, ssize_t n, int err)
+		{
+			add_read(ctx->io_stats_detail, n, err);
+			add_read(this_thread(), n, err);
+		}
+
+		template<class ContextT>
+		static void on_write(ContextT *ctx, ssize_t n, size_t requested, int err)
+		{
+			add_write(ctx->io_stats_detail, n, requested, err);
+			add_write(this_thread(), n, requested, err);
+		}
+
+		template<class ContextT>
+		static void on_queue(ContextT *ctx)
+		{
+			if (0 == ctx->io_stats_flush_start_ns)
+				ctx->io_stats_flush_start_ns = now_ns();
+		}
+
+		template<class ContextT>
+		static void on_flushed(ContextT *ctx)
+		{
+			if (0 == ctx->io_stats_flush_start_ns)
+				return;
+
+			uint64_t const t = now_ns() - ctx->io_stats_flush_start_ns;
+			ctx->io_stats_flush_start_ns = 0;
+
+			add_time(ctx->io_stats_detail.flush_count, ctx->io_stats_detail.flush_ns_total, ctx->io_stats_detail.flush_time, t);
+			add_time(this_thread().flush_count, this_thread().flush_ns_total, this_thread().flush_time, t);
+		}
+
+		template<class ContextT>
+		static uint64_t consume_begin(ContextT *ctx)
+		{
+			return now_ns();
+		}
+
+		template<class ContextT>
+		static void consume_end(ContextT *ctx, uint64_t started_ns)
+		{
+			uint64_t const t = now_ns() - started_ns;
+
+			add_time(ctx->io_stats_detail.consume_count, ctx->io_stats_detail.consume_ns_total, ctx->io_stats_detail.consume_time, t);
+			add_time(this_thread().consume_count, this_thread().consume_ns_total, this_thread().consume_time, t);
+		}
+
+	private:
+
+		static void add_read(io_stats_snapshot_t& s, ssize_t n, int err)
+		{
+			s.read_calls++;
+
+			if (n > 0)
+			{
+				s.read_bytes += n;
+				s.read_size[io_stats_bucket(n, io_stats_snapshot_t::size_buckets)]++;
+			}
+			else if (-1 == n && (EAGAIN == err || EWOULDBLOCK == err))
+			{
+				s.read_eagain++;
+			}
+		}
+
+		static void add_write(io_stats_snapshot_t& s, ssize_t n, size_t requested, int err)
+		{
+			s.write_calls++;
+
+			if (n > 0)
+			{
+				s.write_bytes += n;
+				s.write_size[io_stats_bucket(n, io_stats_snapshot_t::size_buckets)]++;
+
+				if ((size_t)n < requested)
+					s.write_short++;
+			}
+			else if (-1 == n && (EAGAIN == err || EWOULDBLOCK == err))
+			{
+				s.write_eagain++;
+			}
+		}
+
+		static void add_time(uint64_t& count, uint64_t& total, uint64_t *hist, uint64_t t)
+		{
+			count++;
+			total += t;
+			hist[io_stats_bucket(t, io_stats_snapshot_t::time_buckets)]++;
+		}
+	};
+
+	inline io_stats_snapshot_t io_stats_snapshot_impl(io_stats_context_t const *ctx, std::true_type)
+	{
+		return ctx->io_stats_detail;
+	}
+
+	inline io_stats_snapshot_t io_stats_snapshot_impl(void const*, std::false_type)
+	{
+		return io_stats_snapshot_t();
+	}
+
+	// a copy of connection stats, all zeroes if it's not collecting them
+	template<class ConnectionT>
+	inline io_stats_snapshot_t io_stats_snapshot(ConnectionT const *c)
+	{
+		return io_stats_snapshot_impl(c, std::is_base_of<io_stats_context_t, ConnectionT>());
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__IO_STATS_HPP_
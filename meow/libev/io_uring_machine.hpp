@@ -0,0 +1,768 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__IO_URING_MACHINE_HPP_
+#define MEOW_LIBEV__IO_URING_MACHINE_HPP_
+
+#include <sys/eventfd.h>
+#include <sys/uio.h> // iovec
+
+#include <cassert>
+#include <cerrno>
+#include <climits> // INT_MIN
+#include <cstdint>
+#include <cstring> // memset
+#include <thread> // this_thread::yield
+#include <utility> // pair
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/str_ref.hpp>
+#include <meow/unix/io_uring.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/io_machine.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// completion-based io_machine_t replacement
+//
+//  reads are submitted straight into tr_read::get_buffer() memory,
+//  writes are submitted as writev of the iovecs that tr_write::writev_prepare() gathers,
+//  all sqes queued during a loop iteration are submitted with a single io_uring_enter()
+//  from an ev_prepare watcher, completions are delivered via eventfd
+//
+//  usage:
+//   1. create an io_uring_loop_t for every evloop_t that should use it (app owns it)
+//      it takes the loop's userdata (ev_set_userdata()), connections find it there
+//      so loops running io_uring engine connections can't have userdata of their own
+//   2. add 'typedef io_uring_machine_engine_t io_engine;' to connection traits
+//
+//  connections prepared on a loop that has no (working) io_uring_loop_t
+//   silently use the regular readiness based io_machine_t
+//
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct io_uring_op_t
+	{
+		typedef void (*callback_t)(io_uring_op_t*, int result);
+
+		// result slot value for 'no completion', see cancel_and_wait()
+		enum { no_result = INT_MIN };
+
+		callback_t  cb;
+		void       *owner;
+		bool        in_flight; // submitted, kernel has it
+		bool        reaped;    // completed, waiting to be dispatched
+
+		io_uring_op_t() : cb(NULL), owner(NULL), in_flight(false), reaped(false) {}
+
+		// not to be submitted again before the previous completion is dispatched
+		//  the callback works on the state the op was submitted with (read buffer, wchain)
+		bool is_busy() const { return in_flight || reaped; }
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct io_uring_loop_t : private boost::noncopyable
+	{
+		typedef io_uring_loop_t self_t;
+
+		static unsigned const default_entries = 4096;
+
+		struct stats_t
+		{
+			uint64_t enter_calls    = 0; // io_uring_enter() syscalls
+			uint64_t sqes_submitted = 0;
+			uint64_t cqes_reaped    = 0;
+		};
+
+	public:
+
+		io_uring_loop_t(evloop_t *loop, unsigned entries = default_entries)
+			: loop_(loop)
+			, efd_(-1)
+		{
+			ev_init(&efd_ev_, &libev_efd_cb);
+			efd_ev_.data = this;
+
+			ev_prepare_init(&prepare_ev_, &libev_prepare_cb);
+			prepare_ev_.data = this;
+
+			if (!this->setup(entries))
+			{
+				ring_.close();
+				return;
+			}
+
+			ev_io_set(&efd_ev_, efd_, EV_READ);
+			ev_io_start(loop_, &efd_ev_);
+			ev_prepare_start(loop_, &prepare_ev_);
+
+			assert((NULL == ev_userdata(loop_)) && "loop userdata is taken by io_uring_loop_t");
+			ev_set_userdata(loop_, this);
+		}
+
+		~io_uring_loop_t()
+		{
+			if (!this->is_enabled())
+				return;
+
+			if (this == ev_userdata(loop_))
+				ev_set_userdata(loop_, NULL);
+
+			ev_prepare_stop(loop_, &prepare_ev_);
+			ev_io_stop(loop_, &efd_ev_);
+
+			ring_.close(); // kernel cancels everything still in flight
+			::close(efd_);
+		}
+
+		bool is_enabled() const { return ring_.is_valid(); }
+
+		evloop_t*      loop() const { return loop_; }
+		stats_t const& stats() const { return stats_; }
+
+		// the loop registered for given evloop_t or NULL if there is none
+		static self_t* for_loop(evloop_t *loop)
+		{
+			return static_cast<self_t*>(ev_userdata(loop));
+		}
+
+	public:
+
+		// never NULL, if the ring can't take any more sqes
+		//  op completes with -EIO (on the next dispatch) and the sqe returned is a scratch one, never submitted
+		struct io_uring_sqe* get_sqe(io_uring_op_t *op)
+		{
+			struct io_uring_sqe *sqe = this->acquire_sqe();
+			if (NULL == sqe)
+			{
+				std::memset(&scratch_sqe_, 0, sizeof(scratch_sqe_));
+				op->reaped = true;
+				pending_.push_back(std::make_pair(op, -EIO));
+				return &scratch_sqe_;
+			}
+
+			sqe->user_data = (uint64_t)(uintptr_t)op;
+			op->in_flight = true;
+			return sqe;
+		}
+
+		// cancels ops and synchronously waits for them to complete
+		//  needed when releasing the owner, as kernel might still be writing into owner memory
+		//  completions for all other ops, reaped while waiting, are dispatched later as usual
+		// completions of ops themselves are never dispatched
+		//  if results != NULL, results[i] gets the one reaped for ops[i] (or no_result), for the caller to deliver
+		void cancel_and_wait(io_uring_op_t **ops, size_t n_ops, int *results = NULL)
+		{
+			for (size_t i = 0; i < n_ops; ++i)
+			{
+				if (NULL != results)
+					results[i] = io_uring_op_t::no_result;
+
+				if (!ops[i]->in_flight)
+					continue;
+
+				// no sqe to cancel with, the op is left to complete by itself, waiting for it below
+				struct io_uring_sqe *sqe = this->acquire_sqe();
+				if (NULL == sqe)
+					continue;
+
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->fd = -1;
+				sqe->addr = (uint64_t)(uintptr_t)ops[i];
+				sqe->user_data = 0; // cancel completion itself is ignored
+			}
+
+			while (true)
+			{
+				bool any_in_flight = false;
+				for (size_t i = 0; i < n_ops; ++i)
+					any_in_flight |= ops[i]->in_flight;
+
+				if (!any_in_flight)
+					break;
+
+				this->submit(1);
+				this->reap();
+			}
+
+			// completions might have been reaped, but not yet dispatched
+			for (auto& p : pending_)
+			{
+				for (size_t i = 0; i < n_ops; ++i)
+				{
+					if (p.first != ops[i])
+						continue;
+
+					if (NULL != results)
+						results[i] = p.second;
+
+					ops[i]->reaped = false;
+					p.first = NULL;
+				}
+			}
+		}
+
+	private:
+
+		bool setup(unsigned entries)
+		{
+			if (!ring_.setup(entries))
+				return false;
+
+			static int const required_ops[] = { IORING_OP_READ, IORING_OP_WRITEV, IORING_OP_ASYNC_CANCEL };
+			if (!ring_.probe_ops(required_ops, sizeof(required_ops) / sizeof(required_ops[0])))
+				return false;
+
+			efd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (-1 == efd_)
+				return false;
+
+			if (!ring_.register_eventfd(efd_))
+			{
+				::close(efd_);
+				efd_ = -1;
+				return false;
+			}
+
+			return true;
+		}
+
+		int submit(unsigned min_complete = 0)
+		{
+			unsigned const to_submit = ring_.sq_pending();
+			if (0 == to_submit && 0 == min_complete)
+				return 0;
+
+			int const r = ring_.submit(min_complete);
+
+			stats_.enter_calls++;
+			if (r > 0)
+				stats_.sqes_submitted += r;
+
+			return r;
+		}
+
+		// NULL if the ring is broken
+		struct io_uring_sqe* acquire_sqe()
+		{
+			while (true)
+			{
+				struct io_uring_sqe *sqe = ring_.get_sqe();
+				if (NULL != sqe)
+					return sqe;
+
+				// sq is full, no point in waiting for the loop iteration end
+				if (-1 != this->submit())
+					continue;
+
+				if (EBUSY != errno && EAGAIN != errno)
+					return NULL;
+
+				// the kernel won't take more before completions are reaped (they are dispatched later as usual)
+				if (0 == ring_.cq_ready())
+					std::this_thread::yield();
+				this->reap();
+			}
+		}
+
+		void reap()
+		{
+			unsigned const n = ring_.cq_ready();
+
+			for (unsigned i = 0; i < n; ++i)
+			{
+				struct io_uring_cqe const *cqe = ring_.cq_peek(i);
+				io_uring_op_t *op = (io_uring_op_t*)(uintptr_t)cqe->user_data;
+
+				if (NULL == op)
+					continue;
+
+				op->in_flight = false;
+				op->reaped = true;
+				pending_.push_back(std::make_pair(op, cqe->res));
+			}
+
+			ring_.cq_advance(n);
+			stats_.cqes_reaped += n;
+		}
+
+		void dispatch()
+		{
+			// callbacks may release other ops (which removes them from pending_)
+			//  and reap more completions (which appends to pending_), hence indexing
+			for (size_t i = 0; i < pending_.size(); ++i)
+			{
+				std::pair<io_uring_op_t*, int> const p = pending_[i];
+				if (NULL == p.first)
+					continue;
+
+				p.first->reaped = false;
+				p.first->cb(p.first, p.second);
+			}
+
+			pending_.clear();
+		}
+
+		static void libev_efd_cb(evloop_t *loop, evio_t *ev, int revents)
+		{
+			self_t *self = static_cast<self_t*>(ev->data);
+
+			uint64_t v;
+			while (-1 == ::read(self->efd_, &v, sizeof(v)) && EINTR == errno)
+				/**/;
+
+			self->reap();
+			self->dispatch();
+		}
+
+		static void libev_prepare_cb(evloop_t *loop, evprepare_t *ev, int revents)
+		{
+			self_t *self = static_cast<self_t*>(ev->data);
+
+			// completions that arrived without eventfd being polled yet
+			self->reap();
+			self->dispatch();
+
+			self->submit();
+		}
+
+	private:
+		evloop_t           *loop_;
+		os_unix::io_uring_t ring_;
+		int                 efd_;
+		evio_t              efd_ev_;
+		evprepare_t         prepare_ev_;
+		stats_t             stats_;
+		struct io_uring_sqe scratch_sqe_;
+
+		std::vector<std::pair<io_uring_op_t*, int> > pending_;
+	};
+
+	typedef std::unique_ptr<io_uring_loop_t> io_uring_loop_ptr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// per-connection state, connection must inherit from this
+	//  generic_connection_impl_t does it automatically through io_engine selection
+	struct io_uring_context_t
+	{
+		static size_t const writev_max_bufs = 16;
+
+		io_uring_loop_t *uring;  // NULL == using the readiness io_machine_t
+		io_uring_op_t    rd_op;
+		io_uring_op_t    wr_op;
+		buffer_ref       rd_buf;
+		struct iovec     wr_iov[writev_max_bufs];
+		size_t           wr_len; // total of wr_iov submitted
+
+		// completions reaped on detach_context(), delivered by the first run_loop() on the new loop
+		int              rd_carried;
+		int              wr_carried;
+
+		io_uring_context_t()
+			: uring(NULL)
+			, wr_len(0)
+			, rd_carried(io_uring_op_t::no_result)
+			, wr_carried(io_uring_op_t::no_result)
+		{
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	template<
+		  class ContextT
+		, class Traits
+	>
+	struct io_uring_machine_t : private boost::noncopyable
+	{
+		typedef io_uring_machine_t 	self_t;
+		typedef ContextT 			context_t;
+
+		// fallback, for loops without io_uring
+		typedef io_machine_t<ContextT, Traits> 	readiness_machine_t;
+
+		typedef typename readiness_machine_t::tr_base 			tr_base;
+		typedef typename readiness_machine_t::tr_read 			tr_read;
+		typedef typename readiness_machine_t::tr_write 			tr_write;
+		typedef typename readiness_machine_t::tr_allowed_ops 	tr_allowed_ops;
+		typedef typename readiness_machine_t::tr_custom_op 		tr_custom_op;
+		typedef typename readiness_machine_t::tr_log 			tr_log;
+		typedef typename readiness_machine_t::tr_activity 		tr_activity;
+		typedef typename readiness_machine_t::tr_io_stats 		tr_io_stats;
+
+	private: // libev ops
+
+		static void libev_cb(evloop_t *loop, evio_t *ev, int revents)
+		{
+			io_context_t *io_ctx = io_context_t::cast_from_event(ev);
+			context_t *ctx = static_cast<context_t*>(io_ctx->event()->data);
+			self_t::run_loop(ctx, revents);
+		}
+
+	public:
+
+		static void prepare_context(context_t *ctx)
+		{
+			io_uring_context_t *uc = ctx;
+			uc->uring = io_uring_loop_t::for_loop(tr_base::ev_loop(ctx));
+
+			if (NULL == uc->uring)
+			{
+				// run_loop() delivers carried completions before handing over to readiness io
+				readiness_machine_t::prepare_context(ctx);
+				ev_set_cb(tr_base::io_context_ptr(ctx)->event(), &self_t::libev_cb);
+				return;
+			}
+
+			uc->rd_op.owner = ctx;
+			uc->rd_op.cb = &self_t::on_read_complete;
+			uc->wr_op.owner = ctx;
+			uc->wr_op.cb = &self_t::on_write_complete;
+
+			// the watcher is never started, only used to receive activations via ev_feed_event()
+			io_context_t *io_ctx = tr_base::io_context_ptr(ctx);
+			evio_t *ev = io_ctx->event();
+
+			ev_io_init(ev, &self_t::libev_cb, io_ctx->fd(), EV_NONE);
+			ev->data = ctx;
+
+			tr_activity::init(ctx);
+		}
+
+		static void release_context(context_t *ctx)
+		{
+			io_uring_context_t *uc = ctx;
+
+			if (NULL != uc->uring)
+			{
+				io_uring_op_t *ops[] = { &uc->rd_op, &uc->wr_op };
+				uc->uring->cancel_and_wait(ops, sizeof(ops) / sizeof(ops[0]));
+				uc->uring = NULL;
+			}
+
+			uc->rd_carried = io_uring_op_t::no_result;
+			uc->wr_carried = io_uring_op_t::no_result;
+			uc->rd_buf = buffer_ref();
+
+			// activity deinit, stopping the watcher and dropping pending feeds is identical
+			readiness_machine_t::release_context(ctx);
+		}
+
+		// ops that have completed, but not yet dispatched are not lost
+		//  a recv has filled rd_buf and a writev has sent bytes still in wchain
+		//  so they're kept and delivered on the new loop, ops that got cancelled have done nothing
+		static void detach_context(context_t *ctx)
+		{
+			io_uring_context_t *uc = ctx;
+
+			int results[] = { io_uring_op_t::no_result, io_uring_op_t::no_result };
+
+			if (NULL != uc->uring)
+			{
+				io_uring_op_t *ops[] = { &uc->rd_op, &uc->wr_op };
+				uc->uring->cancel_and_wait(ops, sizeof(ops) / sizeof(ops[0]), results);
+				uc->uring = NULL;
+			}
+
+			readiness_machine_t::release_context(ctx);
+
+			uc->rd_carried = self_t::is_carried(results[0]) ? results[0] : (int)io_uring_op_t::no_result;
+			uc->wr_carried = self_t::is_carried(results[1]) ? results[1] : (int)io_uring_op_t::no_result;
+
+			if (io_uring_op_t::no_result == uc->rd_carried)
+				uc->rd_buf = buffer_ref();
+		}
+
+		static void activate_context(context_t *ctx, int io_requested_ops)
+		{
+			readiness_machine_t::activate_context(ctx, io_requested_ops);
+		}
+
+	public:
+
+		static void custom_activate(context_t *ctx) { return self_t::activate_context(ctx, EV_CUSTOM); }
+		static void r_activate(context_t *ctx) { return self_t::activate_context(ctx, EV_READ); }
+		static void w_activate(context_t *ctx) { return self_t::activate_context(ctx, EV_WRITE); }
+		static void rw_activate(context_t *ctx) { return self_t::activate_context(ctx, EV_READ | EV_WRITE); }
+
+		static void custom_loop(context_t *ctx) { self_t::run_loop(ctx, EV_CUSTOM); }
+		static void r_loop(context_t *ctx) { self_t::run_loop(ctx, EV_READ); }
+		static void w_loop(context_t *ctx) { self_t::run_loop(ctx, EV_WRITE); }
+		static void rw_loop(context_t *ctx) { self_t::run_loop(ctx, EV_READ | EV_WRITE); }
+
+	public:
+
+		// same contract as io_machine_t::run_loop()
+		//  but instead of doing io, queues it to the ring (if not already queued)
+		//  read is kept armed after every completion, until get_buffer() returns empty buffer
+		static void run_loop(context_t *ctx, int const io_requested_ops = EV_READ | EV_WRITE)
+		{
+			io_uring_context_t *uc = ctx;
+
+			if (!self_t::deliver_carried(ctx, uc))
+				return;
+
+			if (NULL == uc->uring)
+			{
+				readiness_machine_t::run_loop(ctx, io_requested_ops);
+				return;
+			}
+
+			int const io_allowed_ops = tr_allowed_ops::get(ctx);
+
+			int io_current_ops = (io_allowed_ops & io_requested_ops);
+			if (EV_CUSTOM != io_requested_ops)
+				io_current_ops |= (EV_WRITE & io_allowed_ops);
+
+			int io_activity_ops = EV_NONE;
+
+			while (EV_NONE != io_current_ops)
+			{
+				if (BITMASK_TEST(io_current_ops, EV_CUSTOM))
+				{
+					custom_op_status_t c_status = tr_custom_op::custom_operation(ctx);
+					BITMASK_CLEAR(io_current_ops, EV_CUSTOM);
+
+					io_activity_ops |= EV_CUSTOM;
+
+					if (custom_op_status::closed == c_status)
+						return;
+				}
+
+				if (BITMASK_TEST(io_current_ops, EV_READ))
+				{
+					BITMASK_CLEAR(io_current_ops, EV_READ);
+
+					if (!uc->rd_op.is_busy())
+						self_t::submit_read(ctx, uc);
+				}
+
+				if (tr_custom_op::requires_custom_op(ctx))
+				{
+					BITMASK_SET(io_current_ops, EV_CUSTOM);
+					continue;
+				}
+
+				if (BITMASK_TEST(io_current_ops, EV_WRITE))
+				{
+					BITMASK_CLEAR(io_current_ops, EV_WRITE);
+
+					if (!uc->wr_op.is_busy() && !self_t::submit_write(ctx, uc))
+						return;
+				}
+
+				if (tr_custom_op::requires_custom_op(ctx))
+				{
+					BITMASK_SET(io_current_ops, EV_CUSTOM);
+					continue;
+				}
+			}
+
+			if (io_activity_ops)
+				tr_activity::on_activity(ctx, io_activity_ops);
+		}
+
+	private: // submission
+
+		static void submit_read(context_t *ctx, io_uring_context_t *uc)
+		{
+			buffer_ref const buf_to = tr_read::get_buffer(ctx);
+			if (buf_to.empty())
+				return;
+
+			io_context_t *io_ctx = tr_base::io_context_ptr(ctx);
+
+			if (tr_log::is_allowed(ctx))
+				tr_log::write(ctx, line_mode::single, "{0}; READ({1}, {2}, {3})", __func__, io_ctx->fd(), (void*)buf_to.data(), buf_to.size());
+
+			struct io_uring_sqe *sqe = uc->uring->get_sqe(&uc->rd_op);
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = io_ctx->fd();
+			sqe->addr = (uint64_t)(uintptr_t)buf_to.data();
+			sqe->len = buf_to.size();
+			sqe->off = (uint64_t)-1; // current position, ignored for sockets
+
+			uc->rd_buf = buf_to;
+		}
+
+		// false if the connection got closed
+		static bool submit_write(context_t *ctx, io_uring_context_t *uc)
+		{
+			ssize_t const n_bufs = tr_write::writev_prepare(ctx, uc->wr_iov, io_uring_context_t::writev_max_bufs);
+			if (-1 == n_bufs)
+				return false;
+
+			if (0 == n_bufs)
+				return true;
+
+			uc->wr_len = 0;
+			for (ssize_t i = 0; i < n_bufs; ++i)
+				uc->wr_len += uc->wr_iov[i].iov_len;
+
+			io_context_t *io_ctx = tr_base::io_context_ptr(ctx);
+
+			if (tr_log::is_allowed(ctx))
+				tr_log::write(ctx, line_mode::single, "{0}; WRITEV({1}, {2})", __func__, io_ctx->fd(), n_bufs);
+
+			struct io_uring_sqe *sqe = uc->uring->get_sqe(&uc->wr_op);
+			sqe->opcode = IORING_OP_WRITEV;
+			sqe->fd = io_ctx->fd();
+			sqe->addr = (uint64_t)(uintptr_t)uc->wr_iov;
+			sqe->len = n_bufs;
+			sqe->off = (uint64_t)-1;
+			return true;
+		}
+
+	private: // completion
+
+		// cancelled, or to be retried, nothing done to the stream
+		static bool is_carried(int result)
+		{
+			return (io_uring_op_t::no_result != result) && (-ECANCELED != result) && (-EAGAIN != result) && (-EINTR != result);
+		}
+
+		// false if the connection got closed
+		static bool deliver_carried(context_t *ctx, io_uring_context_t *uc)
+		{
+			if (io_uring_op_t::no_result != uc->rd_carried)
+			{
+				int const result = uc->rd_carried;
+				uc->rd_carried = io_uring_op_t::no_result;
+
+				tr_io_stats::on_read(ctx, (result < 0) ? -1 : result, (result < 0) ? -result : 0);
+
+				if (!self_t::read_complete(ctx, uc, result))
+					return false;
+			}
+
+			if (io_uring_op_t::no_result != uc->wr_carried)
+			{
+				int const result = uc->wr_carried;
+				uc->wr_carried = io_uring_op_t::no_result;
+
+				if (!self_t::write_complete(ctx, uc, result))
+					return false;
+			}
+
+			return true;
+		}
+
+		// false if the connection got closed
+		static bool read_complete(context_t *ctx, io_uring_context_t *uc, int result)
+		{
+			size_t filled_len = 0;
+			read_status_t r_status = read_status::again;
+
+			if (result < 0)
+			{
+				errno = -result; // consumers report errno, as they do with readiness io
+				r_status = read_status::error;
+			}
+			else if (0 == result)
+			{
+				r_status = read_status::closed;
+			}
+			else
+			{
+				filled_len = result;
+				r_status = (filled_len == uc->rd_buf.size()) ? read_status::full : read_status::again;
+			}
+
+			buffer_ref const filled_buf(uc->rd_buf.begin(), filled_len);
+			uc->rd_buf = buffer_ref();
+
+			rd_consume_status_t const c_status = tr_read::consume_buffer(ctx, filled_buf, r_status);
+			if (rd_consume_status::closed == c_status)
+				return false;
+
+			tr_activity::on_activity(ctx, EV_READ);
+			return true;
+		}
+
+		// false if the connection got closed
+		static bool write_complete(context_t *ctx, io_uring_context_t *uc, int result)
+		{
+			wr_complete_status_t const w_status = (result < 0)
+					? tr_write::writev_complete(ctx, -1, uc->wr_len, -result)
+					: tr_write::writev_complete(ctx, result, uc->wr_len, 0)
+					;
+
+			if (wr_complete_status::closed == w_status)
+				return false;
+
+			tr_activity::on_activity(ctx, EV_WRITE);
+			return true;
+		}
+
+		static void on_read_complete(io_uring_op_t *op, int result)
+		{
+			context_t *ctx = static_cast<context_t*>(op->owner);
+			io_uring_context_t *uc = ctx;
+
+			if (tr_log::is_allowed(ctx))
+				tr_log::write(ctx, line_mode::single, "{0}; fd: {1}, result: {2}", __func__, tr_base::io_context_ptr(ctx)->fd(), result);
+
+			tr_io_stats::on_read(ctx, (result < 0) ? -1 : result, (result < 0) ? -result : 0);
+
+			if (-EAGAIN == result || -EINTR == result)
+			{
+				self_t::run_loop(ctx, EV_READ);
+				return;
+			}
+
+			if (!self_t::read_complete(ctx, uc, result))
+				return;
+
+			// re-arm the read and flush whatever consumer has queued for writing
+			self_t::run_loop(ctx, EV_READ);
+		}
+
+		static void on_write_complete(io_uring_op_t *op, int result)
+		{
+			context_t *ctx = static_cast<context_t*>(op->owner);
+			io_uring_context_t *uc = ctx;
+
+			if (tr_log::is_allowed(ctx))
+				tr_log::write(ctx, line_mode::single, "{0}; fd: {1}, result: {2}", __func__, tr_base::io_context_ptr(ctx)->fd(), result);
+
+			if (-EAGAIN == result || -EINTR == result)
+			{
+				self_t::run_loop(ctx, EV_WRITE);
+				return;
+			}
+
+			if (!self_t::write_complete(ctx, uc, result))
+				return;
+
+			// submits the remainder and does a close, if that was waiting for writes to finish
+			self_t::run_loop(ctx, EV_WRITE);
+		}
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct io_uring_machine_engine_t
+	{
+		typedef io_uring_context_t context_t;
+
+		// kernel owns read buffers while the sqe is in flight
+		enum { buffers_in_flight = true };
+
+		template<class ContextT, class Traits>
+		struct machine { typedef io_uring_machine_t<ContextT, Traits> type; };
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__IO_URING_MACHINE_HPP_
@@ -19,6 +19,7 @@ namespace meow { namespace libev {
 	typedef struct ::ev_signal 	evsignal_t;
 	typedef struct ::ev_child   evchild_t;
 	typedef struct ::ev_async   evasync_t;
+	typedef struct ::ev_prepare evprepare_t;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace meow { namespace libev {
@@ -6,6 +6,8 @@
 #ifndef MEOW_LIBEV__LISTENER_HPP_
 #define MEOW_LIBEV__LISTENER_HPP_
 
+#include <cstddef> // size_t
+
 #include <boost/noncopyable.hpp>
 
 #include <meow/std_unique_ptr.hpp>
@@ -28,10 +30,23 @@ namespace meow { namespace libev {
 
 		virtual void 			start(ipv4::address_t const&, int backlog = -1) = 0;
 		virtual void 			shutdown() = 0;
+
+		// max connections accepted per loop wakeup, 0 = until the backlog is empty
+		virtual void 			set_accept_limit(size_t n) = 0;
 	};
 
+	enum { listener_default_accept_limit = 256 };
+
 	typedef std::unique_ptr<listener_t> listener_move_ptr;
 
+	// flags for start_listener()
+	enum listener_flags
+	{
+		// SO_REUSEPORT, any number of listeners (one per loop/thread usually) can bind the same addr:port
+		//  the kernel spreads new connections between them, see meow/libev/listener_sharded.hpp
+		listener_flag_reuseport = 0x1,
+	};
+
 ////////////////////////////////////////////////////////////////////////////////////////////////
 }} // namespace meow { namespace libev {
 ////////////////////////////////////////////////////////////////////////////////////////////////
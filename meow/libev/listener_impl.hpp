@@ -6,10 +6,18 @@
 #ifndef MEOW_LIBEV__LISTENER_IMPL_HPP_
 #define MEOW_LIBEV__LISTENER_IMPL_HPP_
 
-#include <functional> // function
+#include <fcntl.h>      // open
+#include <sys/socket.h> // accept4
+#include <unistd.h>     // close
+
+#include <cerrno>
+#include <cstdint>     // SIZE_MAX
+#include <functional>   // function
+#include <type_traits>  // integral_constant
 
 #include <meow/api_call_error.hpp>
 #include <meow/utility/offsetof.hpp>
+#include <meow/utility/nested_name_alias.hpp>
 
 #include <meow/unix/fd_handle.hpp>
 #include <meow/unix/fcntl.hpp>
@@ -22,18 +30,37 @@
 namespace meow { namespace libev { namespace detail {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+	// CallbackPolicy is usually derived from the listener and incomplete at it's instantiation
+	//  so this is looked up later, when accepting
+	template<class CallbackPolicy>
+	struct listener_callback_traits
+	{
+		struct option_accept_batch_callback_default { enum { value = false }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(CallbackPolicy, option_accept_batch_callback, option_accept_batch_callback_default);
+	};
+
 	template<
 		class CallbackPolicy // CallbackPolicy implements a single function
 							 //  static void listener_callback(listener_t*, int new_socket)
+							 // or, with
+							 //  struct option_accept_batch_callback { enum { value = true }; };
+							 //  static void listener_batch_callback(listener_t*, int const *new_sockets, size_t n)
+							 // new sockets are already non-blocking and close-on-exec
 	>
 	struct listener_static_impl_t : public listener_t
 	{
 		typedef listener_static_impl_t self_t;
 
-		listener_static_impl_t(libev::evloop_t *loop)
+		enum { accept_batch_size = 64 }; // fds handed to the batch callback at once, at most
+
+		listener_static_impl_t(libev::evloop_t *loop, int flags = 0)
 			: loop_(loop)
+			, flags_(flags)
+			, accept_limit_(listener_default_accept_limit)
+			, reserve_fd_(-1)
 		{
 			ev_init(io_ctx_.event(), &libev_cb);
+			ev_init(&pause_ev_, &libev_pause_cb);
 		}
 
 		~listener_static_impl_t()
@@ -48,7 +75,7 @@ namespace meow { namespace libev { namespace detail {
 
 		virtual void start(ipv4::address_t const& addr, int backlog)
 		{
-			if (ev_is_active(io_ctx_.event()))
+			if (io_ctx_.is_valid())
 				this->do_shutdown();
 
 			this->do_start(addr, backlog);
@@ -59,12 +86,19 @@ namespace meow { namespace libev { namespace detail {
 			this->do_shutdown();
 		}
 
+		virtual void set_accept_limit(size_t n)
+		{
+			accept_limit_ = n;
+		}
+
 	private:
 
 		void do_start(ipv4::address_t const& addr, int backlog)
 		{
 			os_unix::fd_handle_t s(os_unix::socket_ex(PF_INET, SOCK_STREAM, 0));
 			os_unix::setsockopt_ex(get_handle(s), SOL_SOCKET, SO_REUSEADDR, int(~0));
+			if (flags_ & listener_flag_reuseport)
+				os_unix::setsockopt_ex(get_handle(s), SOL_SOCKET, SO_REUSEPORT, int(~0));
 			os_unix::bind_ex(get_handle(s), (sockaddr*)addr.sockaddr_tmp(), addr.addrlen());
 			os_unix::listen_ex(get_handle(s), backlog);
 			os_unix::nonblocking(get_handle(s));
@@ -74,15 +108,58 @@ namespace meow { namespace libev { namespace detail {
 			ev_io_start(loop_, io_ctx_.event());
 
 			s.release();
+
+			reserve_fd_ = open_reserve_fd();
 		}
 
 		void do_shutdown()
 		{
+			ev_timer_stop(loop_, &pause_ev_);
+
 			if (io_ctx_.is_valid())
 			{
 				ev_io_stop(loop_, io_ctx_.event());
 				io_ctx_.reset_fd();
 			}
+
+			if (-1 != reserve_fd_)
+			{
+				::close(reserve_fd_);
+				reserve_fd_ = -1;
+			}
+		}
+
+		// kept open to be closed when out of fds
+		//  to accept and drop a connection, as otherwise it stays in the backlog and we spin on it
+		static int open_reserve_fd()
+		{
+			return ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+		}
+
+		// how long accepting is paused for, when out of fds with no reserve to drop a connection with
+		static double pause_interval() { return 0.1; }
+
+		void drop_one_connection()
+		{
+			if (-1 == reserve_fd_)
+				reserve_fd_ = open_reserve_fd();
+
+			// the level triggered watcher would wake us up right away, until an fd gets freed elsewhere
+			if (-1 == reserve_fd_)
+			{
+				ev_io_stop(loop_, io_ctx_.event());
+				ev_timer_set(&pause_ev_, pause_interval(), 0.);
+				ev_timer_start(loop_, &pause_ev_);
+				return;
+			}
+
+			::close(reserve_fd_);
+
+			int const s = ::accept4(fd(), NULL, NULL, SOCK_CLOEXEC);
+			if (-1 != s)
+				::close(s);
+
+			reserve_fd_ = open_reserve_fd();
 		}
 
 	private:
@@ -93,30 +170,119 @@ namespace meow { namespace libev { namespace detail {
 			self->cb(revents);
 		}
 
+		static void libev_pause_cb(libev::evloop_t*, libev::evtimer_t *ev, int revents)
+		{
+			self_t *self = MEOW_SELF_FROM_MEMBER(self_t, pause_ev_, ev);
+
+			if (-1 == self->reserve_fd_)
+				self->reserve_fd_ = open_reserve_fd();
+
+			ev_io_start(self->loop_, self->io_ctx_.event());
+		}
+
 		void cb(int revents)
 		{
-			if (EV_READ & revents)
-			{
+			if (!(EV_READ & revents))
+				return;
 
-				while (true)
+			// the watcher is level triggered, what's left in the backlog will wake us up on the next iteration
+			//  after other watchers had their chance
+			size_t const limit = (0 == accept_limit_) ? SIZE_MAX : accept_limit_;
+
+			int fds[accept_batch_size];
+			size_t n_fds = 0;
+
+			for (size_t accepted = 0; accepted < limit; )
+			{
+				int new_sock = ::accept4(fd(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+				if (-1 == new_sock)
 				{
-					int new_sock = ::accept(fd(), NULL, NULL);
-					if (-1 == new_sock)
+					if (EAGAIN == errno || EWOULDBLOCK == errno)
+						break;
+
+					if (EINTR == errno || is_transient_accept_error(errno))
+						continue;
+
+					if (EMFILE == errno || ENFILE == errno)
 					{
-						if (EAGAIN == errno)
-							break;
-						else
-							throw meow::api_call_error("accept");
+						drop_one_connection();
+						break;
 					}
 
-					CallbackPolicy::listener_callback(this, new_sock);
+					if (ENOBUFS == errno || ENOMEM == errno)
+						break;
+
+					int const err = errno;
+
+					// the ones accepted so far are fine, don't leak them
+					if ((n_fds > 0) && !this->deliver(fds, n_fds))
+						return;
+
+					throw meow::api_call_error(err, "accept4");
+				}
+
+				++accepted;
+
+				fds[n_fds++] = new_sock;
+				if (accept_batch_size == n_fds)
+				{
+					// the callback might have shut us down
+					if (!this->deliver(fds, n_fds))
+						return;
+					n_fds = 0;
 				}
 			}
+
+			if (n_fds > 0)
+				this->deliver(fds, n_fds);
+		}
+
+		// the connection failed before we got to it, see accept(2) on linux
+		static bool is_transient_accept_error(int err)
+		{
+			switch (err)
+			{
+				case ECONNABORTED:
+				case EPROTO:
+				case ENETDOWN:
+				case ENOPROTOOPT:
+				case EHOSTDOWN:
+				case ENONET:
+				case EHOSTUNREACH:
+				case EOPNOTSUPP:
+				case ENETUNREACH:
+				case EPERM: // firewall
+					return true;
+			}
+			return false;
+		}
+
+		// returns false if the listener has been shut down by the callback
+		bool deliver(int const *fds, size_t n_fds)
+		{
+			typedef listener_callback_traits<CallbackPolicy> cb_traits;
+			this->deliver_impl(fds, n_fds, std::integral_constant<bool, cb_traits::option_accept_batch_callback::value>());
+			return io_ctx_.is_valid();
+		}
+
+		void deliver_impl(int const *fds, size_t n_fds, std::true_type)
+		{
+			CallbackPolicy::listener_batch_callback(this, fds, n_fds);
+		}
+
+		void deliver_impl(int const *fds, size_t n_fds, std::false_type)
+		{
+			for (size_t i = 0; i < n_fds; ++i)
+				CallbackPolicy::listener_callback(this, fds[i]);
 		}
 
 	private:
 		libev::io_context_t 	io_ctx_;
 		libev::evloop_t 		*loop_;
+		int                     flags_;
+		size_t                  accept_limit_;
+		int                     reserve_fd_;
+		libev::evtimer_t        pause_ev_;
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -128,41 +294,69 @@ namespace meow { namespace libev { namespace detail {
 		typedef listener_static_impl_t<listener_dynamic_impl_t> base_t;
 
 		typedef std::function<void(listener_t*, int)> callback_t;
+		typedef std::function<void(listener_t*, int const*, size_t)> batch_callback_t;
+
+		struct option_accept_batch_callback { enum { value = true }; };
 
-		listener_dynamic_impl_t(libev::evloop_t *loop, callback_t const& cb)
-			: base_t(loop)
+		listener_dynamic_impl_t(libev::evloop_t *loop, callback_t const& cb, int flags = 0)
+			: base_t(loop, flags)
 			, callback_(cb)
 		{
 		}
 
-		static void listener_callback(base_t *l, int s)
+		listener_dynamic_impl_t(libev::evloop_t *loop, batch_callback_t const& cb, int flags = 0)
+			: base_t(loop, flags)
+			, batch_callback_(cb)
+		{
+		}
+
+		static void listener_batch_callback(base_t *l, int const *fds, size_t n_fds)
 		{
 			self_t *self = static_cast<self_t*>(l);
-			self->callback_(l, s);
+
+			if (self->batch_callback_)
+			{
+				self->batch_callback_(l, fds, n_fds);
+				return;
+			}
+
+			for (size_t i = 0; i < n_fds; ++i)
+				self->callback_(l, fds[i]);
 		}
 
 	private:
-		callback_t callback_;
+		callback_t       callback_;
+		batch_callback_t batch_callback_;
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 } // namespace detail {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-	typedef detail::listener_dynamic_impl_t::callback_t listener_callback_t;
+	typedef detail::listener_dynamic_impl_t::callback_t       listener_callback_t;
+	typedef detail::listener_dynamic_impl_t::batch_callback_t listener_batch_callback_t;
+
+	template<class L>
+	inline listener_move_ptr start_listener(L& loop, ipv4::address_t const& addr, listener_callback_t const& cb, int flags = 0)
+	{
+		listener_move_ptr l(new detail::listener_dynamic_impl_t(get_handle(loop), cb, flags));
+		l->start(addr);
+		return move(l);
+	}
 
+	// all connections accepted in one go, up to accept_batch_size at a time
 	template<class L>
-	inline listener_move_ptr start_listener(L& loop, ipv4::address_t const& addr, listener_callback_t const& cb)
+	inline listener_move_ptr start_listener_batch(L& loop, ipv4::address_t const& addr, listener_batch_callback_t const& cb, int flags = 0)
 	{
-		listener_move_ptr l(new detail::listener_dynamic_impl_t(get_handle(loop), cb));
+		listener_move_ptr l(new detail::listener_dynamic_impl_t(get_handle(loop), cb, flags));
 		l->start(addr);
 		return move(l);
 	}
 
 	template<class L, class CallbackPolicy>
-	inline listener_move_ptr start_listener(L& loop, ipv4::address_t const& addr)
+	inline listener_move_ptr start_listener(L& loop, ipv4::address_t const& addr, int flags = 0)
 	{
-		listener_move_ptr l(new detail::listener_static_impl_t<CallbackPolicy>(get_handle(loop)));
+		listener_move_ptr l(new detail::listener_static_impl_t<CallbackPolicy>(get_handle(loop), flags));
 		l->start(addr);
 		return move(l);
 	}
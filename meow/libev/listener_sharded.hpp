@@ -0,0 +1,187 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV__LISTENER_SHARDED_HPP_
+#define MEOW_LIBEV__LISTENER_SHARDED_HPP_
+
+#include <unistd.h> // close
+
+#include <cassert>
+#include <mutex>
+#include <vector>
+
+#include <meow/libev/listener_impl.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// spreading accepted connections over several loops (one per thread usually)
+//
+// there are two ways
+//  - start_sharded_listener(), a SO_REUSEPORT listener per loop, the kernel balances by connection hash
+//     every loop accepts by itself, nothing is shared
+//  - start_round_robin_listener(), a single acceptor handing fds to the loops in turn via ev_async
+//     for kernels without SO_REUSEPORT or when strict round-robin is needed
+//
+// in both cases the callback is called from the thread running the loop the fd goes to
+//
+// libev watchers can't be started or stopped from other threads
+//  so both are to be created before the loops are run and destroyed after they're done
+
+	// loops[i] gets listeners[i]
+	inline std::vector<listener_move_ptr> start_sharded_listener(
+			  std::vector<evloop_t*> const& loops
+			, ipv4::address_t const& addr
+			, listener_callback_t const& cb
+			, int backlog = -1
+			)
+	{
+		std::vector<listener_move_ptr> result;
+		result.reserve(loops.size());
+
+		for (evloop_t *loop : loops)
+		{
+			listener_move_ptr l(new detail::listener_dynamic_impl_t(loop, cb, listener_flag_reuseport));
+			l->start(addr, backlog);
+			result.push_back(move(l));
+		}
+
+		return result;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace detail {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct listener_round_robin_impl_t
+		: public listener_static_impl_t<listener_round_robin_impl_t>
+	{
+		typedef listener_round_robin_impl_t self_t;
+		typedef listener_static_impl_t<listener_round_robin_impl_t> base_t;
+
+		typedef listener_callback_t callback_t;
+
+		struct shard_t : private boost::noncopyable
+		{
+			self_t            *parent;
+			evloop_t          *loop;
+			evasync_t          ev;
+
+			std::mutex         lock;
+			std::vector<int>   fds;    // accepted, not yet picked up by the loop
+		};
+		typedef std::unique_ptr<shard_t> shard_ptr;
+
+		listener_round_robin_impl_t(evloop_t *accept_loop, std::vector<evloop_t*> const& loops, callback_t const& cb)
+			: base_t(accept_loop)
+			, accept_loop_(accept_loop)
+			, callback_(cb)
+			, next_(0)
+		{
+			assert(!loops.empty());
+
+			for (evloop_t *loop : loops)
+			{
+				shard_ptr sh(new shard_t);
+				sh->parent = this;
+				sh->loop = loop;
+
+				ev_async_init(&sh->ev, &shard_cb);
+				sh->ev.data = sh.get();
+
+				// the acceptor loop gets its share directly
+				if (loop != accept_loop)
+					ev_async_start(loop, &sh->ev);
+
+				shards_.push_back(move(sh));
+			}
+		}
+
+		~listener_round_robin_impl_t()
+		{
+			for (shard_ptr& sh : shards_)
+			{
+				if (ev_is_active(&sh->ev))
+					ev_async_stop(sh->loop, &sh->ev);
+
+				for (int fd : sh->fds)
+					::close(fd);
+			}
+		}
+
+		static void listener_callback(base_t *l, int s)
+		{
+			self_t *self = static_cast<self_t*>(l);
+			self->dispatch(s);
+		}
+
+	private:
+
+		void dispatch(int fd)
+		{
+			shard_t *sh = shards_[next_].get();
+			next_ = (next_ + 1 == shards_.size()) ? 0 : next_ + 1;
+
+			if (sh->loop == accept_loop_)
+			{
+				callback_(this, fd);
+				return;
+			}
+
+			{
+				std::lock_guard<std::mutex> g_(sh->lock);
+				sh->fds.push_back(fd);
+			}
+
+			// coalesces multiple sends until the loop wakes up
+			ev_async_send(sh->loop, &sh->ev);
+		}
+
+		static void shard_cb(evloop_t*, evasync_t *ev, int revents)
+		{
+			shard_t *sh = static_cast<shard_t*>(ev->data);
+
+			std::vector<int> fds;
+			{
+				std::lock_guard<std::mutex> g_(sh->lock);
+				fds.swap(sh->fds);
+			}
+
+			for (int fd : fds)
+				sh->parent->callback_(sh->parent, fd);
+		}
+
+	private:
+		evloop_t                *accept_loop_;
+		callback_t              callback_;
+		std::vector<shard_ptr>  shards_;
+		size_t                  next_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace detail {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// accepts on loop, hands out fds to loops in turn, loop itself may be one of them
+	template<class L>
+	inline listener_move_ptr start_round_robin_listener(
+			  L& loop
+			, std::vector<evloop_t*> const& loops
+			, ipv4::address_t const& addr
+			, listener_callback_t const& cb
+			, int backlog = -1
+			)
+	{
+		listener_move_ptr l(new detail::listener_round_robin_impl_t(get_handle(loop), loops, cb));
+		l->start(addr, backlog);
+		return move(l);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__LISTENER_SHARDED_HPP_
@@ -22,8 +22,26 @@ namespace meow { namespace libev {
 		virtual ~mmc_reader_events_t() {}
 
 		virtual bool on_message(connection_t*, str_ref const& message) = 0;
+
+		// a batch of messages found in the read buffer, with option_mmc_batch > 1
+		//  returns how many were consumed, the rest stay in the read buffer till the next read
+		//  less than n_messages means 'stop for now', same as on_message() returning false
+		//  the default calls on_message() for each, till it returns false or the connection is closed
+		virtual size_t on_messages(connection_t *c, str_ref const *messages, size_t n_messages)
+		{
+			for (size_t i = 0; i < n_messages; ++i)
+			{
+				if (!this->on_message(c, messages[i]) || c->is_closing())
+					return i + 1;
+			}
+			return n_messages;
+		}
 		virtual void on_error(connection_t*, str_ref const& error_msg) = 0;
 		virtual void on_closed(connection_t*, io_close_report_t const&) = 0;
+
+		// write queue backpressure, see option_write_high_watermark
+		virtual void on_write_blocked(connection_t*) {}
+		virtual void on_write_drained(connection_t*) {}
 	};
 
 	struct mmc_connection_t
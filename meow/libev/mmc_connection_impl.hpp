@@ -6,6 +6,8 @@
 #ifndef MEOW_LIBEV__MMC_CONNECTION_IMPL_HPP_
 #define MEOW_LIBEV__MMC_CONNECTION_IMPL_HPP_
 
+#include <algorithm> // min, max
+
 #include <meow/utility/nested_name_alias.hpp>
 
 #include <meow/libev/mmc_connection.hpp>
@@ -59,6 +61,14 @@ namespace meow { namespace libev {
 				return c->module->max_message_length;
 			}
 		};
+
+		// up to this many messages are fetched from the buffer in one go and delivered to on_messages()
+		//  default: 1, on_message() for each
+		struct option_mmc_batch { enum { value = 64 }; };
+
+		// read buffer starts with this size and is grown 2x (up to max_message_length) when a message doesn't fit
+		//  default: 4096
+		struct option_mmc_read_buffer_initial_size { enum { value = 1024 }; };
 	};
 
 #endif
@@ -69,6 +79,19 @@ namespace meow { namespace libev {
 		buffer_move_ptr r_buf;
 	};
 
+	template<class Traits>
+	struct mmc_reader_options
+	{
+		struct option_mmc_batch_default { enum { value = 1 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_mmc_batch, option_mmc_batch_default);
+
+		struct option_mmc_read_buffer_initial_size_default { enum { value = 4096 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_mmc_read_buffer_initial_size, option_mmc_read_buffer_initial_size_default);
+
+		static_assert(option_mmc_batch::value >= 1, "option_mmc_batch must be at least 1");
+		static_assert(option_mmc_read_buffer_initial_size::value >= 1, "option_mmc_read_buffer_initial_size must be at least 1");
+	};
+
 	template<class Traits>
 	struct mmc_reader_operations
 	{
@@ -77,6 +100,14 @@ namespace meow { namespace libev {
 
 		typedef typename traits::ctx_info   tr_ctx_info;
 		typedef typename traits::mmc_read   tr_mmc_read;
+		typedef generic_connection_buffer_traits<traits> tr_buffers;
+		typedef mmc_reader_options<traits>  tr_options;
+
+		enum
+		{
+			batch_size          = tr_options::option_mmc_batch::value,
+			initial_buffer_size = tr_options::option_mmc_read_buffer_initial_size::value,
+		};
 
 		typedef libev::read_status          read_status;
 		typedef libev::read_status_t        read_status_t;
@@ -88,13 +119,34 @@ namespace meow { namespace libev {
 		static buffer_ref get_buffer(ConnectionT *c)
 		{
 			buffer_move_ptr& b = tr_ctx_info::get_context(c)->r_buf;
+			size_t const max_len = tr_mmc_read::max_message_length(c);
+
+			if (tr_buffers::option_read_scratch_buffer::value)
+			{
+				// the tail is kept in b as well, we might read nothing
+				read_scratch_buffer_t *s = read_scratch_buffer_t::this_thread();
+				if (!s->in_use)
+					return s->take((b) ? b->used_part() : str_ref(), max_len);
+			}
 
 			if (!b)
-				b.reset(new buffer_t(tr_mmc_read::max_message_length(c)));
+				b = tr_buffers::create_read_buffer(std::min((size_t)initial_buffer_size, max_len));
+			else if (b->full()) // right-sized tail, left by scratch buffer read
+				self_t::grow_buffer(*b, max_len);
 
 			return b->free_part();
 		}
 
+		// makes room at the end, by moving the data to the front or, if there is no room there either,
+		//  by doubling the size (but no more than max_len, the caller checks there is some room left)
+		static void grow_buffer(buffer_t& b, size_t max_len)
+		{
+			buffer_move_used_part_to_front(b);
+
+			if (b.full())
+				b.resize_to(std::min(std::max(b.size() * 2, (size_t)initial_buffer_size), max_len));
+		}
+
 		template<class ConnectionT>
 		static rd_consume_status_t consume_buffer(ConnectionT* c, buffer_ref read_part, read_status_t r_status)
 		{
@@ -118,30 +170,61 @@ namespace meow { namespace libev {
 		static rd_consume_status_t read_process_buffer_data(ConnectionT *c, buffer_ref read_part, bool is_closed)
 		{
 			buffer_move_ptr& b = tr_ctx_info::get_context(c)->r_buf;
+
+			if (tr_buffers::option_read_scratch_buffer::value)
+			{
+				read_scratch_buffer_t *s = read_scratch_buffer_t::this_thread();
+				if (s->owns(read_part))
+					return self_t::read_process_scratch_data(c, s, read_part);
+			}
+
 			b->advance_last(read_part.size());
+			return self_t::read_process_messages(c, b.get(), tr_mmc_read::max_message_length(c));
+		}
 
-			while (!c->is_closing())
+		template<class ConnectionT>
+		static rd_consume_status_t read_process_scratch_data(ConnectionT *c, read_scratch_buffer_t *s, buffer_ref read_part)
+		{
+			buffer_move_ptr& b = tr_ctx_info::get_context(c)->r_buf;
+
+			s->in_use = true;
+			s->buf.advance_last(read_part.size());
+
+			rd_consume_status_t const result = self_t::read_process_messages(c, &s->buf, tr_mmc_read::max_message_length(c));
+
+			// copy out the partial message (if any)
+			str_ref const tail = s->buf.used_part();
+
+			if (tail.empty())
 			{
-				char const *found_e = tr_mmc_read::fetch_message(c, b->used_part());
-				if (NULL == found_e)
-				{
-					if (b->full())
-					{
-						// try recover by moving the data around
-						buffer_move_used_part_to_front(*b);
+				b.reset();
+			}
+			else
+			{
+				if (!b || b->size() < tail.size())
+					b = tr_buffers::create_read_buffer(tail.size());
 
-						// if it's still full -> we have to bail
-						if (b->full())
-						{
-							b->clear();
+				b->clear();
+				copy_to_buffer(*b, tail.data(), tail.size());
+			}
 
-							tr_ctx_info::get_events(c)->on_error(c, ref_lit("message is too long"));
-							return rd_consume_status::loop_break;
-						}
-					}
+			s->in_use = false;
+			return result;
+		}
 
-					return rd_consume_status::more;
-				}
+		// max_len: messages longer than that are an error
+		//  the buffer is grown up to that, when a partial message fills it up
+		template<class ConnectionT>
+		static rd_consume_status_t read_process_messages(ConnectionT *c, buffer_t *b, size_t max_len)
+		{
+			if (batch_size > 1)
+				return self_t::read_process_message_batches(c, b, max_len);
+
+			while (!c->is_closing())
+			{
+				char const *found_e = tr_mmc_read::fetch_message(c, b->used_part());
+				if (NULL == found_e)
+					return self_t::read_process_partial(c, b, max_len);
 				else
 				{
 					str_ref const message_s = str_ref(b->first, found_e);
@@ -166,6 +249,68 @@ namespace meow { namespace libev {
 
 			return rd_consume_status::loop_break;
 		}
+
+		// all the messages found are delivered together, batch_size at a time
+		//  the buffer is advanced past them before on_messages(), same as it is for on_message()
+		//  and moved back to the first one not consumed, if on_messages() stops early
+		//  the data stays intact till the next read
+		template<class ConnectionT>
+		static rd_consume_status_t read_process_message_batches(ConnectionT *c, buffer_t *b, size_t max_len)
+		{
+			str_ref msgs[batch_size];
+
+			while (!c->is_closing())
+			{
+				// each fetch starts where the previous message ends, one pass over the data in total
+				size_t n_msgs = 0;
+				while (n_msgs < (size_t)batch_size)
+				{
+					char const *found_e = tr_mmc_read::fetch_message(c, b->used_part());
+					if (NULL == found_e)
+						break;
+
+					msgs[n_msgs++] = str_ref(b->first, found_e);
+					b->advance_first(found_e - b->first);
+				}
+
+				if (0 == n_msgs)
+					return self_t::read_process_partial(c, b, max_len);
+
+				size_t const n_consumed = tr_ctx_info::get_events(c)->on_messages(c, msgs, n_msgs);
+
+				// unconsumed messages are right before b->first, in order
+				if (n_consumed < n_msgs)
+					b->first = const_cast<char*>(msgs[n_consumed].begin());
+
+				if (b->empty())
+					b->clear();
+
+				if (n_consumed < n_msgs)
+					return rd_consume_status::more;
+			}
+
+			return rd_consume_status::loop_break;
+		}
+
+		// no complete message in the buffer
+		template<class ConnectionT>
+		static rd_consume_status_t read_process_partial(ConnectionT *c, buffer_t *b, size_t max_len)
+		{
+			// if it's too long already -> we have to bail
+			if (b->used_size() >= max_len)
+			{
+				b->clear();
+
+				tr_ctx_info::get_events(c)->on_error(c, ref_lit("message is too long"));
+				return rd_consume_status::loop_break;
+			}
+
+			// make room for the rest of it
+			if (b->full())
+				self_t::grow_buffer(*b, max_len);
+
+			return rd_consume_status::more;
+		}
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -173,11 +318,28 @@ namespace meow { namespace libev {
 	template<class Traits /* the client supplied traits here */ >
 	struct mmc_connection_repack_traits : public Traits
 	{
+		typedef generic_connection_buffer_traits<Traits> tr_buffers;
+
+		// nothing is allocated for idle connections when reading to scratch buffer
+		//  so there is no point in paying for poll() before each read
+		MEOW_DEFINE_NESTED_NAME_ALIAS_EX(Traits, read_precheck, user_read_precheck, void, void);
+		typedef typename std::conditional<
+							  tr_buffers::option_read_scratch_buffer::value
+							, void
+							, user_read_precheck
+							>::type read_precheck;
+
 		// internal implementation detail,
 		//  customising the behaviour of mmc_reader_operations<>
 		//  for use with connection built-in reader
 		struct mmc_reader_operations_traits__
 		{
+			typedef typename tr_buffers::option_read_buffer_pool    option_read_buffer_pool;
+			typedef typename tr_buffers::option_read_scratch_buffer option_read_scratch_buffer;
+
+			typedef typename mmc_reader_options<Traits>::option_mmc_batch                    option_mmc_batch;
+			typedef typename mmc_reader_options<Traits>::option_mmc_read_buffer_initial_size option_mmc_read_buffer_initial_size;
+
 			struct ctx_info
 			{
 				template<class ConnectionT>
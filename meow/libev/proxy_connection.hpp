@@ -73,6 +73,7 @@ namespace meow { namespace libev {
 	{
 		using log_writer = typename Traits::log_writer; // needed for IO_LOG_WRITE to work, makes log_writer a dependent name
 		using tr_read    = typename Traits::read;
+		using tr_buffers = generic_connection_buffer_traits<Traits>;
 
 		struct read
 		{
@@ -118,7 +119,7 @@ namespace meow { namespace libev {
 				}
 
 				if (!ctx->proxy_rbuf)
-					ctx->proxy_rbuf = meow::create_buffer(network_buffer_size);
+					ctx->proxy_rbuf = tr_buffers::create_read_buffer(network_buffer_size);
 
 				return ctx->proxy_rbuf->free_part();
 			}
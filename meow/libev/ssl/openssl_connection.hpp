@@ -9,7 +9,12 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+#include <cstdint>
+#include <algorithm> // min
+
 #include <meow/str_ref.hpp>
+#include <meow/buffer_pool.hpp>
+#include <meow/buffer_file_region.hpp>
 #include <meow/std_unique_ptr.hpp>
 #include <meow/tmp_buffer.hpp>
 #include <meow/format/format.hpp>
@@ -76,6 +81,14 @@ namespace meow { namespace libev {
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+	// plaintext written to ssl, records are counted assuming they're the max size (16kb) for larger writes
+	//  bytes / records is the average record payload
+	struct openssl_write_stats_t
+	{
+		uint64_t records = 0;
+		uint64_t bytes   = 0;
+	};
+
 	struct openssl_connection_t : public generic_connection_t
 	{
 		virtual ~openssl_connection_t() {}
@@ -122,6 +135,20 @@ namespace meow { namespace libev {
 		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, base, generic_connection_traits__base<Traits>);
 
 		typedef typename Traits::read tr_read;
+		typedef generic_connection_buffer_traits<Traits> tr_buffers;
+
+		// small buffers from the write chain are gathered into records of up to this many bytes
+		//  and given to SSL_write() together, instead of a record per buffer
+		//  larger buffers and file regions still go on their own, the gathered data before them is written first
+		//  struct option_ssl_write_record_size { enum { value = 16 * 1024 }; };
+		//  default: 0, a SSL_write() per buffer
+		struct option_ssl_write_record_size_default { enum { value = 0 }; };
+		MEOW_DEFINE_NESTED_NAME_ALIAS_OR_MY_TYPE(Traits, option_ssl_write_record_size, option_ssl_write_record_size_default);
+
+		enum { write_record_size = option_ssl_write_record_size::value };
+
+		// records are produced by SSL_write() inside writev_bufs(), completion based engines bypass that
+		typedef io_machine_engine_t io_engine;
 
 	public: // io context
 
@@ -129,8 +156,11 @@ namespace meow { namespace libev {
 		{
 			buffer_move_ptr  ssl_rbuf;
 			buffer_chain_t   ssl_wchain;
+			buffer_move_ptr  ssl_wrecord; // gathered plaintext, see option_ssl_write_record_size
 			ssl_move_ptr     rw_ssl;
 			bool             ssl_handshake_done = false;
+
+			openssl_write_stats_t ssl_wstats;
 		};
 
 	public: // helpers
@@ -148,7 +178,8 @@ namespace meow { namespace libev {
 			template<class ContextT>
 			static bool has_buffers_to_send(ContextT *ctx)
 			{
-				return !(ctx->wchain_.empty() && ctx->ssl_wchain.empty());
+				return !(ctx->wchain_.empty() && ctx->ssl_wchain.empty())
+					|| (ctx->ssl_wrecord && 0 != ctx->ssl_wrecord->used_size());
 			}
 		};
 
@@ -165,7 +196,7 @@ namespace meow { namespace libev {
 
 				buffer_move_ptr& b = ctx->ssl_rbuf;
 				if (!b)
-					b = create_buffer(network_buffer_size);
+					b = tr_buffers::create_read_buffer(network_buffer_size);
 
 				return b->free_part();
 			}
@@ -344,12 +375,42 @@ namespace meow { namespace libev {
 					else
 					{
 						b->advance_first(r);
+
+						ctx->ssl_wstats.records += (r + SSL3_RT_MAX_PLAIN_LENGTH - 1) / SSL3_RT_MAX_PLAIN_LENGTH;
+						ctx->ssl_wstats.bytes   += r;
 					}
 				}
 
 				return wr_okay;
 			}
 
+			// writes the front buffer of the chain, on its own
+			//  sets is_stalled if ssl didn't take all of it (i.e. wants to read first)
+			template<class ContextT>
+			static write_result_t write_front_to_ssl(ContextT *ctx, buffer_chain_t& from, bool *is_stalled)
+			{
+				buffer_t *b = from.front();
+
+				// file regions are read into memory of their buffers piece by piece, to be encrypted
+				if (0 == b->used_size() && !b->empty())
+				{
+					if (buffer_file_region_fill(*b, 16 * 1024 /* tls record */) <= 0)
+						return wr_error;
+				}
+
+				write_result_t wr = write_buffer_to_ssl(ctx, b);
+
+				if (wr_okay != wr)
+					return wr;
+
+				if (b->empty())
+					from.pop_front();
+				else if (0 != b->used_size())
+					*is_stalled = true;
+
+				return wr_okay;
+			}
+
 			template<class ContextT>
 			static write_result_t move_wchain_buffers_from_to(ContextT *ctx, buffer_chain_t& from, buffer_chain_t *to)
 			{
@@ -360,26 +421,84 @@ namespace meow { namespace libev {
 					return wr_okay;
 				}
 
+				if (write_record_size > 0)
+					return move_wchain_records_to_ssl(ctx, from);
+
 				// write as much as possible to ssl
-				while (!from.empty())
+				bool is_stalled = false;
+				while (!from.empty() && !is_stalled)
 				{
-					buffer_t *b = from.front();
-					write_result_t wr = write_buffer_to_ssl(ctx, b);
+					write_result_t wr = write_front_to_ssl(ctx, from, &is_stalled);
 
 					if (wr_okay != wr)
 						return wr;
+				}
 
-					if (b->empty())
-						from.pop_front();
-					else
+				return wr_okay;
+			}
+
+			// option_ssl_write_record_size
+			//  the data is copied to ssl_wrecord till it's full, a buffer larger than that is split to fill the record up
+			//  ssl_wrecord is kept till ssl takes all of it, as SSL_write() needs the same data on retry
+			template<class ContextT>
+			static write_result_t move_wchain_records_to_ssl(ContextT *ctx, buffer_chain_t& from)
+			{
+				buffer_move_ptr& rec = ctx->ssl_wrecord;
+
+				while (true)
+				{
+					while (!from.empty() && (!rec || !rec->full()))
+					{
+						buffer_t *b = from.front();
+						size_t const sz = b->used_size();
+
+						bool const rec_empty = (!rec || 0 == rec->used_size());
+						if (NULL != b->file_region() || (rec_empty && sz >= (size_t)write_record_size))
+							break;
+
+						if (!rec)
+							rec = create_buffer_from_pool(write_record_size);
+
+						size_t const n = std::min(sz, rec->free_size());
+						copy_to_buffer(*rec, b->first, n);
+						b->advance_first(n);
+
+						if (b->empty())
+							from.pop_front();
+					}
+
+					if (rec && 0 != rec->used_size())
+					{
+						write_result_t wr = write_buffer_to_ssl(ctx, rec.get());
+
+						if (wr_okay != wr)
+							return wr;
+
+						if (!rec->empty())
+							return wr_okay;
+
+						rec->clear();
+						continue;
+					}
+
+					if (from.empty())
 						break;
+
+					// a large one or a file region
+					bool is_stalled = false;
+					write_result_t wr = write_front_to_ssl(ctx, from, &is_stalled);
+
+					if (wr_okay != wr || is_stalled)
+						return wr;
 				}
 
+				// idle connections don't keep it
+				rec.reset();
 				return wr_okay;
 			}
 
 			template<class ContextT>
-			static wr_complete_status_t writev_bufs(ContextT *ctx)
+			static wr_complete_status_t writev_bufs(ContextT *ctx, size_t max_bytes = 0)
 			{
 				write_result_t wr = move_wchain_buffers_from_to(ctx, ctx->wchain_, &ctx->ssl_wchain);
 
@@ -395,10 +514,17 @@ namespace meow { namespace libev {
 
 					case wr_okay:
 					default:
-						return write::writev_from_wchain(ctx, ctx->ssl_wchain);
+						break;
 				}
 
-				assert(!"can't be reached");
+				// records go out with the same syscalls, and are counted there (on_write() and bytes_written)
+				//  flushed is when all the plaintext went to ssl and all the records it made are written
+				wr_complete_status_t const r = write::writev_from_wchain(ctx, ctx->ssl_wchain, max_bytes);
+
+				if (wr_complete_status::finished == r && ctx->wchain_.empty() && (!ctx->ssl_wrecord || 0 == ctx->ssl_wrecord->used_size()))
+					write::tr_io_stats::on_flushed(ctx);
+
+				return r;
 			}
 		};
 	};
@@ -506,6 +632,12 @@ namespace meow { namespace libev {
 		return !!conn->rw_ssl;
 	}
 
+	template<class ConnectionT>
+	openssl_write_stats_t const& openssl_connection_write_stats(ConnectionT *conn)
+	{
+		return conn->ssl_wstats;
+	}
+
 	template<class ConnectionT>
 	void openssl_connection_init_acquire_ssl(ConnectionT *conn, openssl_move_ptr ssl)
 	{
@@ -0,0 +1,505 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_LIBEV_SSL__OPENSSL_SESSION_CACHE_HPP_
+#define MEOW_LIBEV_SSL__OPENSSL_SESSION_CACHE_HPP_
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <ctime>
+#include <cstring> // memcpy, memcmp
+
+#include <algorithm> // max
+#include <atomic>
+#include <list>
+#include <memory> // shared_ptr, atomic_load
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/str_ref.hpp>
+#include <meow/libev/ssl/openssl_connection.hpp> // openssl_ctx_t, openssl_session_t
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+// session resumption state shared by openssl_ctx_t-s of several loops (threads)
+//  openssl_session_cache_t: server side session-id cache, used in place of the per-ctx internal one
+//  openssl_ticket_keys_t:   session ticket keys, rotated, the previous few are still accepted
+//
+// both are attached to a ctx with openssl_*_attach(ctx, object) before it's used for connections
+//  and must outlive all the ctx-s they're attached to
+// a server asking for client certificates needs SSL_CTX_set_session_id_context() as well
+
+	struct openssl_session_cache_stats_t
+	{
+		uint64_t lookups   = 0;
+		uint64_t hits      = 0;
+		uint64_t misses    = 0; // not found or expired
+		uint64_t expired   = 0;
+		uint64_t stores    = 0;
+		uint64_t evictions = 0; // dropped to keep the shard under its capacity
+		uint64_t removals  = 0; // invalidated by openssl
+
+		double hit_rate() const { return (lookups) ? double(hits) / lookups : 0.0; }
+	};
+
+	// sessions are sharded by id, a mutex per shard, lookups from different threads rarely meet
+	//  each shard is an lru of up to capacity / n_shards sessions
+	struct openssl_session_cache_t : private boost::noncopyable
+	{
+		typedef openssl_session_cache_t self_t;
+
+		explicit openssl_session_cache_t(size_t capacity = 64 * 1024, size_t n_shards = 16)
+			: shards_(n_shards ? n_shards : 1)
+			, shard_capacity_(std::max(capacity / shards_.size(), (size_t)1))
+		{
+		}
+
+		~openssl_session_cache_t()
+		{
+			for (shard_t& shard : shards_)
+			{
+				for (auto& kv : shard.items)
+					SSL_SESSION_free(kv.second.sess);
+			}
+		}
+
+		openssl_session_cache_stats_t stats() const
+		{
+			openssl_session_cache_stats_t s;
+			s.lookups   = st_lookups_.load(std::memory_order_relaxed);
+			s.hits      = st_hits_.load(std::memory_order_relaxed);
+			s.misses    = s.lookups - s.hits;
+			s.expired   = st_expired_.load(std::memory_order_relaxed);
+			s.stores    = st_stores_.load(std::memory_order_relaxed);
+			s.evictions = st_evictions_.load(std::memory_order_relaxed);
+			s.removals  = st_removals_.load(std::memory_order_relaxed);
+			return s;
+		}
+
+		size_t size() const
+		{
+			size_t result = 0;
+			for (shard_t const& shard : shards_)
+			{
+				std::lock_guard<std::mutex> g_(shard.lock);
+				result += shard.items.size();
+			}
+			return result;
+		}
+
+	public:
+
+		// takes a reference of its own
+		void store(openssl_session_t *sess)
+		{
+			std::string id = session_id(sess);
+			shard_t& shard = this->shard_for(id);
+
+			SSL_SESSION_up_ref(sess);
+			st_stores_.fetch_add(1, std::memory_order_relaxed);
+
+			std::lock_guard<std::mutex> g_(shard.lock);
+
+			auto i = shard.items.find(id);
+			if (shard.items.end() != i)
+			{
+				SSL_SESSION_free(i->second.sess);
+				i->second.sess = sess;
+				shard.lru.splice(shard.lru.begin(), shard.lru, i->second.lru_i);
+				return;
+			}
+
+			shard.lru.push_front(id);
+			shard.items.emplace(move(id), item_t { sess, shard.lru.begin() });
+
+			while (shard.items.size() > shard_capacity_)
+			{
+				shard.erase(shard.lru.back());
+				st_evictions_.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		// a new reference, NULL if not found or expired
+		openssl_session_t* lookup(str_ref const& id)
+		{
+			st_lookups_.fetch_add(1, std::memory_order_relaxed);
+
+			std::string const key = id.str();
+			shard_t& shard = this->shard_for(key);
+
+			std::lock_guard<std::mutex> g_(shard.lock);
+
+			auto i = shard.items.find(key);
+			if (shard.items.end() == i)
+				return NULL;
+
+			openssl_session_t *sess = i->second.sess;
+			if (SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) < (long)::time(NULL))
+			{
+				shard.erase(key);
+				st_expired_.fetch_add(1, std::memory_order_relaxed);
+				return NULL;
+			}
+
+			shard.lru.splice(shard.lru.begin(), shard.lru, i->second.lru_i);
+			st_hits_.fetch_add(1, std::memory_order_relaxed);
+
+			SSL_SESSION_up_ref(sess);
+			return sess;
+		}
+
+		void remove(openssl_session_t *sess)
+		{
+			std::string const id = session_id(sess);
+			shard_t& shard = this->shard_for(id);
+
+			std::lock_guard<std::mutex> g_(shard.lock);
+			if (shard.erase(id))
+				st_removals_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+	public: // openssl callbacks, see openssl_session_cache_attach()
+
+		static int ex_index()
+		{
+			static int const idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+			return idx;
+		}
+
+		static self_t* from_ctx(openssl_ctx_t *ctx)
+		{
+			return static_cast<self_t*>(SSL_CTX_get_ex_data(ctx, ex_index()));
+		}
+
+		static int new_session_cb(SSL *ssl, openssl_session_t *sess)
+		{
+#ifdef TLS1_3_VERSION
+			// tls 1.3 stateless tickets come here as well, nobody is going to look them up by id
+			if (SSL_version(ssl) >= TLS1_3_VERSION && !(SSL_get_options(ssl) & SSL_OP_NO_TICKET))
+				return 0;
+#endif
+			from_ctx(SSL_get_SSL_CTX(ssl))->store(sess);
+			return 0; // the reference passed here is not kept, store() takes one
+		}
+
+		static void remove_session_cb(openssl_ctx_t *ctx, openssl_session_t *sess)
+		{
+			from_ctx(ctx)->remove(sess);
+		}
+
+		static openssl_session_t* get_session_cb(SSL *ssl, unsigned char const *id, int id_len, int *copy)
+		{
+			*copy = 0; // the reference is taken by lookup(), under the shard lock
+			return from_ctx(SSL_get_SSL_CTX(ssl))->lookup(str_ref((char const*)id, id_len));
+		}
+
+	private:
+
+		struct item_t
+		{
+			openssl_session_t                *sess;
+			std::list<std::string>::iterator  lru_i;
+		};
+
+		struct shard_t
+		{
+			mutable std::mutex                        lock;
+			std::unordered_map<std::string, item_t>   items;
+			std::list<std::string>                    lru; // most recently used at front
+
+			bool erase(std::string const& id)
+			{
+				auto i = items.find(id);
+				if (items.end() == i)
+					return false;
+
+				SSL_SESSION_free(i->second.sess);
+				lru.erase(i->second.lru_i);
+				items.erase(i);
+				return true;
+			}
+		};
+
+		static std::string session_id(openssl_session_t *sess)
+		{
+			unsigned int len = 0;
+			unsigned char const *id = SSL_SESSION_get_id(sess, &len);
+			return std::string((char const*)id, len);
+		}
+
+		shard_t& shard_for(std::string const& id)
+		{
+			return shards_[std::hash<std::string>()(id) % shards_.size()];
+		}
+
+	private:
+		std::vector<shard_t>  shards_;
+		size_t const          shard_capacity_;
+
+		std::atomic<uint64_t> st_lookups_   { 0 };
+		std::atomic<uint64_t> st_hits_      { 0 };
+		std::atomic<uint64_t> st_expired_   { 0 };
+		std::atomic<uint64_t> st_stores_    { 0 };
+		std::atomic<uint64_t> st_evictions_ { 0 };
+		std::atomic<uint64_t> st_removals_  { 0 };
+	};
+
+	// the cache replaces the ctx internal one, the same cache can go to any number of ctx-s
+	inline void openssl_session_cache_attach(openssl_ctx_t *ctx, openssl_session_cache_t *cache)
+	{
+		SSL_CTX_set_ex_data(ctx, openssl_session_cache_t::ex_index(), cache);
+
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+		SSL_CTX_sess_set_new_cb(ctx, &openssl_session_cache_t::new_session_cb);
+		SSL_CTX_sess_set_remove_cb(ctx, &openssl_session_cache_t::remove_session_cb);
+		SSL_CTX_sess_set_get_cb(ctx, &openssl_session_cache_t::get_session_cb);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct openssl_ticket_keys_stats_t
+	{
+		uint64_t issued          = 0; // tickets encrypted
+		uint64_t resumed         = 0; // decrypted with the current key
+		uint64_t resumed_renewed = 0; // decrypted with a previous key, a new ticket is issued
+		uint64_t unknown_key     = 0; // key is gone (or never was ours), full handshake
+
+		uint64_t resumptions() const { return resumed + resumed_renewed; }
+		double hit_rate() const
+		{
+			uint64_t const total = resumptions() + unknown_key;
+			return (total) ? double(resumptions()) / total : 0.0;
+		}
+	};
+
+	// keys are an immutable set, replaced as a whole on rotation
+	//  lookups just grab the current set (atomic_load() of a shared_ptr), rotation is serialized with a mutex
+	// a key issues tickets for rotate_interval seconds, and is accepted for n_keep_previous intervals more
+	struct openssl_ticket_keys_t : private boost::noncopyable
+	{
+		typedef openssl_ticket_keys_t self_t;
+
+		struct key_t
+		{
+			unsigned char name[16];
+			unsigned char aes_key[32];
+			unsigned char hmac_key[32];
+			time_t        created;
+		};
+
+		explicit openssl_ticket_keys_t(time_t rotate_interval = 3600, size_t n_keep_previous = 2)
+			: rotate_interval_(rotate_interval)
+			, n_keep_previous_(n_keep_previous)
+		{
+			this->rotate();
+		}
+
+		openssl_ticket_keys_stats_t stats() const
+		{
+			openssl_ticket_keys_stats_t s;
+			s.issued          = st_issued_.load(std::memory_order_relaxed);
+			s.resumed         = st_resumed_.load(std::memory_order_relaxed);
+			s.resumed_renewed = st_renewed_.load(std::memory_order_relaxed);
+			s.unknown_key     = st_unknown_.load(std::memory_order_relaxed);
+			return s;
+		}
+
+		// a new key for issuing tickets, the current one goes to the accepted ones
+		//  called by itself when the current key gets older than rotate_interval
+		//  or explicitly, i.e. from a timer, to keep the keys in sync with other servers (see add_key())
+		void rotate()
+		{
+			key_t const k = random_key();
+
+			std::lock_guard<std::mutex> g_(rotate_lock_);
+			this->add_key_locked(k);
+		}
+
+		// k becomes the current key (i.e. the one shared by a cluster of servers)
+		void add_key(key_t const& k)
+		{
+			std::lock_guard<std::mutex> g_(rotate_lock_);
+			this->add_key_locked(k);
+		}
+
+	public: // openssl callback, see openssl_ticket_keys_attach()
+
+		static int ex_index()
+		{
+			static int const idx = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+			return idx;
+		}
+
+		// HMAC_CTX is deprecated since 3.0, the callback gets an EVP_MAC_CTX there
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		typedef EVP_MAC_CTX hmac_ctx_t;
+#else
+		typedef HMAC_CTX    hmac_ctx_t;
+#endif
+
+		// 1: ok, 2: ok, but issue a new ticket, 0: unknown key, -1: error
+		static int ticket_key_cb(SSL *ssl, unsigned char name[16], unsigned char iv[16], EVP_CIPHER_CTX *cctx, hmac_ctx_t *hctx, int enc)
+		{
+			self_t *self = static_cast<self_t*>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ex_index()));
+			return (enc)
+					? self->encrypt_ticket(name, iv, cctx, hctx)
+					: self->decrypt_ticket(name, iv, cctx, hctx)
+					;
+		}
+
+	private:
+
+		typedef std::vector<key_t>              keys_t; // current first
+		typedef std::shared_ptr<keys_t const>   keys_ptr;
+
+		static key_t random_key()
+		{
+			key_t k;
+			if (1 != RAND_bytes(k.name, sizeof(k.name))
+				|| 1 != RAND_bytes(k.aes_key, sizeof(k.aes_key))
+				|| 1 != RAND_bytes(k.hmac_key, sizeof(k.hmac_key)))
+			{
+				throw std::runtime_error("openssl_ticket_keys_t: RAND_bytes() failed");
+			}
+			k.created = ::time(NULL);
+			return k;
+		}
+
+		static bool hmac_init(hmac_ctx_t *hctx, key_t const& k)
+		{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+			OSSL_PARAM params[] = {
+				OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(k.hmac_key), sizeof(k.hmac_key)),
+				OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("sha256"), 0),
+				OSSL_PARAM_construct_end(),
+			};
+			return 1 == EVP_MAC_CTX_set_params(hctx, params);
+#else
+			return 1 == HMAC_Init_ex(hctx, k.hmac_key, sizeof(k.hmac_key), EVP_sha256(), NULL);
+#endif
+		}
+
+		// rotate_lock_ is held
+		void add_key_locked(key_t const& k)
+		{
+			keys_ptr const old_keys = std::atomic_load(&keys_);
+
+			auto new_keys = std::make_shared<keys_t>();
+			new_keys->push_back(k);
+
+			if (old_keys)
+			{
+				for (size_t i = 0; i < old_keys->size() && new_keys->size() <= n_keep_previous_; ++i)
+					new_keys->push_back((*old_keys)[i]);
+			}
+
+			std::atomic_store(&keys_, keys_ptr(move(new_keys)));
+		}
+
+		int encrypt_ticket(unsigned char name[16], unsigned char iv[16], EVP_CIPHER_CTX *cctx, hmac_ctx_t *hctx)
+		{
+			keys_ptr keys = std::atomic_load(&keys_);
+
+			if (rotate_interval_ > 0 && keys->front().created + rotate_interval_ <= ::time(NULL))
+			{
+				this->rotate_if_not_yet(keys->front());
+				keys = std::atomic_load(&keys_);
+			}
+
+			key_t const& k = keys->front();
+
+			if (1 != RAND_bytes(iv, 16))
+				return -1;
+
+			std::memcpy(name, k.name, sizeof(k.name));
+			if (1 != EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, k.aes_key, iv) || !hmac_init(hctx, k))
+				return -1;
+
+			st_issued_.fetch_add(1, std::memory_order_relaxed);
+			return 1;
+		}
+
+		int decrypt_ticket(unsigned char name[16], unsigned char iv[16], EVP_CIPHER_CTX *cctx, hmac_ctx_t *hctx)
+		{
+			keys_ptr const keys = std::atomic_load(&keys_);
+
+			for (size_t i = 0; i < keys->size(); ++i)
+			{
+				key_t const& k = (*keys)[i];
+				if (0 != std::memcmp(name, k.name, sizeof(k.name)))
+					continue;
+
+				if (!hmac_init(hctx, k) || 1 != EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, k.aes_key, iv))
+					return -1;
+
+				if (0 == i)
+				{
+					st_resumed_.fetch_add(1, std::memory_order_relaxed);
+					return 1;
+				}
+
+				st_renewed_.fetch_add(1, std::memory_order_relaxed);
+				return 2;
+			}
+
+			st_unknown_.fetch_add(1, std::memory_order_relaxed);
+			return 0;
+		}
+
+		// several threads can see the key getting old at once, only the first one rotates
+		//  the check and the swap are under the same lock hold, or the ones behind it would rotate again
+		void rotate_if_not_yet(key_t const& seen)
+		{
+			std::lock_guard<std::mutex> g_(rotate_lock_);
+			if (0 != std::memcmp(std::atomic_load(&keys_)->front().name, seen.name, sizeof(seen.name)))
+				return;
+
+			this->add_key_locked(random_key());
+		}
+
+	private:
+		time_t const          rotate_interval_;
+		size_t const          n_keep_previous_;
+
+		std::mutex            rotate_lock_;
+		keys_ptr              keys_;
+
+		std::atomic<uint64_t> st_issued_  { 0 };
+		std::atomic<uint64_t> st_resumed_ { 0 };
+		std::atomic<uint64_t> st_renewed_ { 0 };
+		std::atomic<uint64_t> st_unknown_ { 0 };
+	};
+
+	inline void openssl_ticket_keys_attach(openssl_ctx_t *ctx, openssl_ticket_keys_t *keys)
+	{
+		SSL_CTX_set_ex_data(ctx, openssl_ticket_keys_t::ex_index(), keys);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+		SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, &openssl_ticket_keys_t::ticket_key_cb);
+#else
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, &openssl_ticket_keys_t::ticket_key_cb);
+#endif
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+}} // namespace meow { namespace libev {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV_SSL__OPENSSL_SESSION_CACHE_HPP_
@@ -3,27 +3,41 @@
 // (c) Anton Povarov <anton.povarov@gmail.com>
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
+#ifndef MEOW_LIBEV__WORKER_THREAD_POOL_HPP_
+#define MEOW_LIBEV__WORKER_THREAD_POOL_HPP_
+
+#include <cassert>
 #include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
 #include <meow/std_unique_ptr.hpp>
-#include <meow/ptr_list.hpp>
+#include <meow/thread_placement.hpp>
+#include <meow/libev/libev.hpp>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 namespace meow {
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-	struct worker_item_t : public meow::ptr_list_hook_t
+	struct worker_queue_node_t
+	{
+		std::atomic<worker_queue_node_t*> q_next { nullptr };
+	};
+
+	struct worker_item_t : public worker_queue_node_t
 	{
 		virtual ~worker_item_t() {}
-		virtual bool is_shutdown() const = 0;
-		virtual void work()              = 0;
-		virtual void callback()          = 0;
+		virtual void work()     = 0;
+		virtual void callback() = 0;
 	};
 	typedef std::unique_ptr<worker_item_t> worker_item_ptr;
 
@@ -39,9 +53,8 @@ namespace meow {
 		{
 		}
 
-		virtual bool is_shutdown() const { return false; }
-		virtual void work()              { work_(state_); }
-		virtual void callback()          { callback_(state_); }
+		virtual void work()     { work_(state_); }
+		virtual void callback() { callback_(state_); }
 
 	private:
 		state_t state_;
@@ -49,11 +62,120 @@ namespace meow {
 		CF      callback_;
 	};
 
-	struct worker_item_shutdown_t : public worker_item_t
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// intrusive queue, any number of threads push, one pops at a time (Vyukov's non-blocking mpsc)
+	//  push is a single exchange, a chain of items linked through q_next is pushed at once
+	//  pop() can return NULL while a push is half way through, the pusher is to wake the popper after it's done
+	//  pop() is not safe to call concurrently, see pop_shared() for when more than one thread pops
+	struct worker_mpsc_queue_t : private boost::noncopyable
 	{
-		virtual bool is_shutdown() const { return true; }
-		virtual void work()              {}
-		virtual void callback()          {}
+		worker_mpsc_queue_t()
+			: head_(&stub_)
+			, tail_(&stub_)
+		{
+		}
+
+		void push(worker_queue_node_t *first, worker_queue_node_t *last)
+		{
+			last->q_next.store(nullptr, std::memory_order_relaxed);
+			worker_queue_node_t *prev = head_.exchange(last);
+			prev->q_next.store(first);
+		}
+
+		void push(worker_queue_node_t *n)
+		{
+			this->push(n, n);
+		}
+
+		// consumer only
+		worker_queue_node_t* pop()
+		{
+			worker_queue_node_t *tail = tail_;
+			worker_queue_node_t *next = tail->q_next.load();
+
+			if (&stub_ == tail)
+			{
+				if (nullptr == next)
+					return nullptr;
+
+				tail_ = tail = next;
+				next = next->q_next.load();
+			}
+
+			if (nullptr != next)
+			{
+				tail_ = next;
+				return tail;
+			}
+
+			if (tail != head_.load())
+				return nullptr; // somebody is pushing right now
+
+			this->push(&stub_);
+
+			next = tail->q_next.load();
+			if (nullptr != next)
+			{
+				tail_ = next;
+				return tail;
+			}
+
+			return nullptr;
+		}
+
+		// any thread, poppers take turns on a spinlock that is only held for the pop itself
+		//  pushers never touch it
+		worker_queue_node_t* pop_shared()
+		{
+			while (pop_claim_.exchange(true, std::memory_order_acquire))
+				std::this_thread::yield();
+
+			worker_queue_node_t *n = this->pop();
+
+			pop_claim_.store(false, std::memory_order_release);
+			return n;
+		}
+
+	private:
+		std::atomic<worker_queue_node_t*> head_; // last pushed
+		worker_queue_node_t              *tail_; // next to pop
+		worker_queue_node_t               stub_;
+		std::atomic<bool>                 pop_claim_ { false };
+	};
+
+	// intrusive stack, any number of threads push, one takes everything at once
+	//  push() tells if the stack was empty, i.e. if the consumer needs a wakeup
+	struct worker_mpsc_stack_t : private boost::noncopyable
+	{
+		bool push(worker_queue_node_t *n)
+		{
+			worker_queue_node_t *top = top_.load(std::memory_order_relaxed);
+			do {
+				n->q_next.store(top, std::memory_order_relaxed);
+			} while (!top_.compare_exchange_weak(top, n, std::memory_order_release, std::memory_order_relaxed));
+
+			return (nullptr == top);
+		}
+
+		// in push order
+		worker_queue_node_t* grab_all()
+		{
+			worker_queue_node_t *n = top_.exchange(nullptr, std::memory_order_acquire);
+
+			worker_queue_node_t *result = nullptr;
+			while (nullptr != n)
+			{
+				worker_queue_node_t *next = n->q_next.load(std::memory_order_relaxed);
+				n->q_next.store(result, std::memory_order_relaxed);
+				result = n;
+				n = next;
+			}
+			return result;
+		}
+
+	private:
+		std::atomic<worker_queue_node_t*> top_ { nullptr };
 	};
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -61,49 +183,150 @@ namespace meow {
 	using libev::evloop_t;
 	using libev::evasync_t;
 
-	struct workers_t
+	// work() runs on worker threads, callback() on the loop
+	//  items are given to threads in turn, each thread has a queue of its own
+	//  a thread that has run out of its own items takes them from the other threads' queues
+	//   so a slow item only holds up the items behind it until somebody is free
+	//  a thread with nothing to do sleeps on its condition variable, and is only notified when asleep
+	//   an item queued to a busy thread wakes up a sleeping one to come and take it
+	//  finished items go to a single stack, the loop is woken up when it was empty
+	//   so one wakeup covers all the results that are ready by the time the loop gets to them
+	struct workers_t : private boost::noncopyable
 	{
-		using queue_t = meow::ptr_list_t<worker_item_t>;
+		struct thread_t : private boost::noncopyable
+		{
+			std::thread               thr;
+			size_t                    idx;
+			worker_mpsc_queue_t       queue;
+
+			std::atomic<bool>         is_sleeping { false };
+			std::mutex                sleep_lock;
+			std::condition_variable   sleep_cond;
+		};
+		using thread_ptr = std::unique_ptr<thread_t>;
 
 		workers_t(evloop_t *l)
 			: loop(l)
-			, shutting_down(0)
+			, shutting_down(false)
+			, next_thread(0)
 		{
 		}
 
+		~workers_t()
+		{
+			// leftovers, scheduled after shutdown or finished but not called back
+			for (auto& th : t)
+			{
+				while (worker_queue_node_t *n = th->queue.pop())
+					delete static_cast<worker_item_t*>(n);
+			}
+
+			worker_queue_node_t *n = r_stack.grab_all();
+			while (nullptr != n)
+			{
+				worker_queue_node_t *next = n->q_next.load(std::memory_order_relaxed);
+				delete static_cast<worker_item_t*>(n);
+				n = next;
+			}
+		}
+
 		evloop_t                 *loop;
 		evasync_t                 ev;
-		uint64_t                  shutting_down;
+		std::atomic<bool>         shutting_down;
 
-		queue_t                   r_queue;
-		std::mutex                r_lock;
+		worker_mpsc_stack_t       r_stack;
 
-		std::vector<std::thread>  t;
-		queue_t                   w_queue;
-		std::mutex                w_lock;
-		std::condition_variable   w_cond;
+		std::vector<thread_ptr>   t;
+		std::atomic<size_t>       next_thread;
 	};
 	typedef std::unique_ptr<workers_t> workers_ptr;
 
-	inline workers_ptr workers_init(evloop_t *loop, size_t n)
+	namespace detail {
+
+		inline bool workers_wakeup_thread(workers_t::thread_t *th)
+		{
+			// seq_cst pairs with the store to is_sleeping before the thread checks the queues the last time
+			if (!th->is_sleeping.load())
+				return false;
+
+			std::lock_guard<std::mutex> g_{ th->sleep_lock };
+			th->sleep_cond.notify_one();
+			return true;
+		}
+
+		// wake up the thread the items went to, or somebody else to take them if it's busy
+		inline void workers_wakeup_for(workers_t& ctx, workers_t::thread_t *th)
+		{
+			if (workers_wakeup_thread(th))
+				return;
+
+			for (size_t i = 1; i < ctx.t.size(); ++i)
+			{
+				if (workers_wakeup_thread(ctx.t[(th->idx + i) % ctx.t.size()].get()))
+					return;
+			}
+		}
+
+		// own queue first, then the others', starting from the next thread
+		inline worker_item_t* workers_find_item(workers_t& ctx, workers_t::thread_t *th)
+		{
+			for (size_t i = 0; i < ctx.t.size(); ++i)
+			{
+				if (worker_queue_node_t *n = ctx.t[(th->idx + i) % ctx.t.size()]->queue.pop_shared())
+					return static_cast<worker_item_t*>(n);
+			}
+			return nullptr;
+		}
+
+		// NULL when shutting down and there is nothing left to do
+		inline worker_item_t* workers_wait_item(workers_t& ctx, workers_t::thread_t *th)
+		{
+			if (worker_item_t *item = workers_find_item(ctx, th))
+				return item;
+
+			std::unique_lock<std::mutex> lk_ { th->sleep_lock };
+			th->is_sleeping.store(true);
+
+			worker_item_t *item;
+			while (nullptr == (item = workers_find_item(ctx, th)))
+			{
+				if (ctx.shutting_down.load())
+					break;
+				th->sleep_cond.wait(lk_);
+			}
+
+			th->is_sleeping.store(false, std::memory_order_relaxed);
+			return item;
+		}
+
+		// items linked through q_next, first to last
+		inline void workers_push_chain(workers_t& ctx, worker_item_t *first, worker_item_t *last)
+		{
+			workers_t::thread_t *th = ctx.t[ctx.next_thread.fetch_add(1, std::memory_order_relaxed) % ctx.t.size()].get();
+			th->queue.push(first, last);
+			workers_wakeup_for(ctx, th);
+		}
+
+	} // namespace detail {
+
+	// threads are placed as the placement says, if there is one
+	//  n > 0, items are pushed to threads round robin and a pool without threads would never run them
+	inline workers_ptr workers_init(evloop_t *loop, size_t n, thread_placement_ptr const& placement = {})
 	{
+		assert((n > 0) && "workers_init(): need at least one thread");
+
 		auto ctx = workers_ptr { new workers_t (loop) };
 
 		auto const thr_wakeup = [](evloop_t *loop, evasync_t *ev, int revents)
 		{
 			auto parent = static_cast<workers_t*>(ev->data);
 
-			// ff::fmt(stdout, "thr wakeup {0}\n", parent);
-
-			workers_t::queue_t q;
+			worker_queue_node_t *n = parent->r_stack.grab_all();
+			while (nullptr != n)
 			{
-				std::lock_guard<std::mutex> g_{ parent->r_lock };
-				q.swap(parent->r_queue);
-			}
+				worker_item_ptr item { static_cast<worker_item_t*>(n) };
+				n = n->q_next.load(std::memory_order_relaxed);
 
-			while (!q.empty())
-			{
-				auto item = q.grab_front();
 				item->callback();
 			}
 		};
@@ -118,28 +341,31 @@ namespace meow {
 
 		for (size_t i = 0; i < n; i++)
 		{
-			ctx->t.emplace_back(std::thread { [parent]() {
+			ctx->t.emplace_back(new workers_t::thread_t);
+			ctx->t.back()->idx = i;
+		}
+
+		for (auto& th_ptr : ctx->t)
+		{
+			workers_t::thread_t *th = th_ptr.get();
+			size_t const slot = thread_placement_next_slot(placement);
+
+			th->thr = std::thread { [parent, th, placement, slot]() {
+				thread_placement_apply(placement, slot);
+
 				while (true)
 				{
-					auto item = [parent]() {
-						std::unique_lock<std::mutex> lk_ { parent->w_lock };
-						parent->w_cond.wait(lk_, [&]() { return !parent->w_queue.empty(); });
-						return parent->w_queue.grab_front(); // grab stuff from the queue and unlock in dtor
-					}();
+					worker_item_ptr item { detail::workers_wait_item(*parent, th) };
 
-					if (item->is_shutdown())
+					if (!item)
 						break;
 
 					item->work();
 
-					{
-						std::lock_guard<std::mutex> g_{ parent->r_lock };
-						parent->r_queue.push_back(move(item));
-					}
-
-					ev_async_send(parent->loop, &parent->ev);
+					if (parent->r_stack.push(item.release()))
+						ev_async_send(parent->loop, &parent->ev);
 				}
-			} });
+			} };
 		}
 
 		return move(ctx);
@@ -148,53 +374,62 @@ namespace meow {
 	template<class T, class WF, class CF>
 	inline void workers_schedule(workers_t& ctx, T&& state, WF const& work, CF const& callback)
 	{
-		auto item = meow::make_unique<worker_item_impl_t<T, WF, CF>>(std::forward<T>(state), work, callback);
-		auto parent = &ctx;
+		if (ctx.shutting_down.load(std::memory_order_relaxed))
+			return;
 
-		{
-			std::lock_guard<std::mutex> g_{ parent->w_lock };
-			if (parent->shutting_down != 0)
-				return;
-
-			parent->w_queue.push_back(move(item));
-		}
-
-		parent->w_cond.notify_one();
+		auto *item = new worker_item_impl_t<T, WF, CF>(std::forward<T>(state), work, callback);
+		detail::workers_push_chain(ctx, item, item);
 	}
 
-	inline void workers_shutdown(workers_t& ctx)
+	// states from [begin, end) are moved into items, the items are split between threads in even chunks
+	//  each thread gets its chunk with a single push and at most one wakeup
+	template<class Iterator, class WF, class CF>
+	inline void workers_schedule_batch(workers_t& ctx, Iterator begin, Iterator end, WF const& work, CF const& callback)
 	{
-		auto parent = &ctx;
+		using state_t = typename std::iterator_traits<Iterator>::value_type;
+		using item_t  = worker_item_impl_t<state_t, WF, CF>;
+
+		if (ctx.shutting_down.load(std::memory_order_relaxed))
+			return;
 
+		size_t const n_items = std::distance(begin, end);
+		size_t const n_chunks = std::min(n_items, ctx.t.size());
+
+		for (size_t i = 0; i < n_chunks; ++i)
 		{
-			std::lock_guard<std::mutex> g_{ parent->w_lock };
+			size_t const chunk_size = n_items / n_chunks + ((i < n_items % n_chunks) ? 1 : 0);
 
-			parent->shutting_down = 1;
+			item_t *first = new item_t(std::move(*begin++), work, callback);
+			item_t *last = first;
 
-			// send shutdown messages
-			for (size_t i = 0; i < parent->t.size(); i++)
+			for (size_t j = 1; j < chunk_size; ++j)
 			{
-				// ff::fmt(stdout, "sending shutdown signal {0}\n", i);
-				parent->w_queue.push_back(meow::make_unique<worker_item_shutdown_t>());
+				item_t *item = new item_t(std::move(*begin++), work, callback);
+				last->q_next.store(item, std::memory_order_relaxed);
+				last = item;
 			}
-		}
 
-		for (size_t i = 0; i < parent->t.size(); i++)
-		{
-			parent->w_cond.notify_one(); // would notify_all() work here ?
+			detail::workers_push_chain(ctx, first, last);
 		}
+	}
 
-		// wait for threads to finish
-		for (size_t i = 0; i < ctx.t.size(); i++)
-		{
-			// ff::fmt(stdout, "joining thread {0}\n", i);
-			parent->t[i].join();
-		}
+	inline void workers_shutdown(workers_t& ctx)
+	{
+		auto parent = &ctx;
 
-		// ff::fmt(stdout, "workers_stop done\n");
-	}
+		// seq_cst pairs with the store to is_sleeping, threads finish the items already queued and exit
+		parent->shutting_down.store(true);
 
+		for (auto& th : parent->t)
+			detail::workers_wakeup_thread(th.get());
+
+		// wait for threads to finish
+		for (auto& th : parent->t)
+			th->thr.join();
+	}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 } // namespace meow
 ////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_LIBEV__WORKER_THREAD_POOL_HPP_
@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW__THREAD_PLACEMENT_HPP_
+#define MEOW__THREAD_PLACEMENT_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <meow/unix/thread_affinity.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// what happened to a thread, given to the report callback from that thread, before it does anything else
+	struct thread_placement_report_t
+	{
+		size_t            slot;   // threads are numbered in the order they are started with this placement
+		std::vector<int>  cpus;   // the thread is allowed to run on, empty = not pinned
+		int               cpu;    // where it was when reported
+		int               node;   // numa node of cpu
+		int               error;  // from pthread_setaffinity_np(), the thread runs unpinned then
+	};
+
+	// where worker and executor threads run
+	//  made once and shared by all the pools/executors (on the loop thread for same_node())
+	//  so that i.e. one_per_core() spreads all of their threads over different cores
+	//
+	// threads pin themselves as the first thing they do
+	//  so whatever they allocate afterwards (task envs, buffers) is first touched on their node
+	struct thread_placement_t : private boost::noncopyable
+	{
+		using report_fn_t = std::function<void(thread_placement_report_t const&)>;
+
+		// every thread can run on any of these
+		static std::shared_ptr<thread_placement_t> cpu_set(std::vector<int> cpus)
+		{
+			return std::shared_ptr<thread_placement_t>(new thread_placement_t({ move(cpus) }));
+		}
+
+		// a thread per physical core (first hw thread of each), in turn, wrapping around
+		//  cores are taken from the ones this process is allowed to run on
+		static std::shared_ptr<thread_placement_t> one_per_core()
+		{
+			std::vector<os_unix::cpu_topology_t> cores;
+			for (int cpu : os_unix::process_allowed_cpus())
+			{
+				os_unix::cpu_topology_t const t = os_unix::cpu_topology(cpu);
+
+				auto const same_core = [&t](os_unix::cpu_topology_t const& other)
+				{
+					return (-1 != t.core_id) && (t.core_id == other.core_id) && (t.package_id == other.package_id);
+				};
+
+				if (cores.end() == std::find_if(cores.begin(), cores.end(), same_core))
+					cores.push_back(t);
+			}
+
+			std::vector<std::vector<int>> slots;
+			for (auto const& t : cores)
+				slots.push_back({ t.cpu });
+
+			return std::shared_ptr<thread_placement_t>(new thread_placement_t(move(slots)));
+		}
+
+		// all threads on the cpus of the numa node the calling thread is on now
+		//  call it from the loop thread, pinned to its node for this to be stable
+		//  no numa info = no pinning
+		static std::shared_ptr<thread_placement_t> same_node()
+		{
+			int const node = os_unix::cpu_topology(os_unix::current_cpu()).node;
+
+			std::vector<int> cpus;
+			if (-1 != node)
+			{
+				for (int cpu : os_unix::process_allowed_cpus())
+				{
+					if (node == os_unix::cpu_topology(cpu).node)
+						cpus.push_back(cpu);
+				}
+			}
+
+			return std::shared_ptr<thread_placement_t>(new thread_placement_t({ move(cpus) }));
+		}
+
+	public:
+
+		void set_report(report_fn_t fn) { report_fn_ = move(fn); }
+
+		// main thread, when starting a thread, slots are taken in order
+		size_t next_slot()
+		{
+			return next_slot_.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		std::vector<int> const& slot_cpus(size_t slot) const
+		{
+			return slots_[slot % slots_.size()];
+		}
+
+		// the started thread, before anything else
+		void apply(size_t slot) const
+		{
+			thread_placement_report_t r;
+			r.slot  = slot;
+			r.cpus  = this->slot_cpus(slot);
+			r.error = r.cpus.empty() ? 0 : os_unix::thread_set_affinity(::pthread_self(), r.cpus);
+
+			if (0 != r.error)
+				r.cpus.clear();
+
+			r.cpu  = os_unix::current_cpu();
+			r.node = (-1 != r.cpu) ? os_unix::cpu_topology(r.cpu).node : -1;
+
+			if (report_fn_)
+				report_fn_(r);
+		}
+
+	private:
+
+		explicit thread_placement_t(std::vector<std::vector<int>> slots)
+			: slots_(move(slots))
+			, next_slot_(0)
+		{
+			if (slots_.empty())
+				slots_.push_back({});
+		}
+
+	private:
+		std::vector<std::vector<int>> slots_; // cpus for thread in slot i, wrapped
+		std::atomic<size_t>           next_slot_;
+		report_fn_t                   report_fn_;
+	};
+
+	typedef std::shared_ptr<thread_placement_t> thread_placement_ptr;
+
+	// started threads call this first, no placement = nothing happens
+	//  slot is taken beforehand, on the starting thread, so that numbering is deterministic
+	inline void thread_placement_apply(thread_placement_ptr const& placement, size_t slot)
+	{
+		if (placement)
+			placement->apply(slot);
+	}
+
+	inline size_t thread_placement_next_slot(thread_placement_ptr const& placement)
+	{
+		return placement ? placement->next_slot() : 0;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace meow {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW__THREAD_PLACEMENT_HPP_
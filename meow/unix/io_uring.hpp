@@ -0,0 +1,269 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_UNIX__IO_URING_HPP_
+#define MEOW_UNIX__IO_URING_HPP_
+
+// minimal raw io_uring(7) wrapper, no liburing dependency
+//  only what libev integration needs: single-issuer ring, sqe/cqe access, batched submit
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring> // memset
+#include <cstdlib> // calloc
+
+#include <boost/noncopyable.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace os_unix {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	inline int io_uring_setup(unsigned entries, struct io_uring_params *p)
+	{
+		return (int)::syscall(__NR_io_uring_setup, entries, p);
+	}
+
+	inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+	{
+		return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+	}
+
+	inline int io_uring_register(int fd, unsigned opcode, void const *arg, unsigned nr_args)
+	{
+		return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	struct io_uring_t : private boost::noncopyable
+	{
+		io_uring_t()
+		{
+			this->reset_members();
+		}
+
+		~io_uring_t()
+		{
+			this->close();
+		}
+
+		bool is_valid() const { return -1 != fd_; }
+		int  fd() const { return fd_; }
+
+	public:
+
+		// returns false and sets errno if the kernel (or seccomp policy) does not let us have a ring
+		bool setup(unsigned entries)
+		{
+			struct io_uring_params p;
+			std::memset(&p, 0, sizeof(p));
+
+			int fd = io_uring_setup(entries, &p);
+			if (-1 == fd)
+				return false;
+
+			fd_ = fd;
+
+			sq_ring_sz_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			cq_ring_sz_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+			bool const single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+			if (single_mmap)
+				sq_ring_sz_ = cq_ring_sz_ = (sq_ring_sz_ > cq_ring_sz_) ? sq_ring_sz_ : cq_ring_sz_;
+
+			sq_ring_ = ::mmap(NULL, sq_ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+			if (MAP_FAILED == sq_ring_)
+				return this->setup_failed();
+
+			if (single_mmap)
+			{
+				cq_ring_ = sq_ring_;
+			}
+			else
+			{
+				cq_ring_ = ::mmap(NULL, cq_ring_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+				if (MAP_FAILED == cq_ring_)
+					return this->setup_failed();
+			}
+
+			sqes_sz_ = p.sq_entries * sizeof(struct io_uring_sqe);
+			sqes_ = (struct io_uring_sqe*)::mmap(NULL, sqes_sz_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+			if (MAP_FAILED == (void*)sqes_)
+				return this->setup_failed();
+
+			char *sq = (char*)sq_ring_;
+			sq_head_    = (unsigned*)(sq + p.sq_off.head);
+			sq_tail_    = (unsigned*)(sq + p.sq_off.tail);
+			sq_mask_    = *(unsigned*)(sq + p.sq_off.ring_mask);
+			sq_entries_ = *(unsigned*)(sq + p.sq_off.ring_entries);
+			sq_array_   = (unsigned*)(sq + p.sq_off.array);
+
+			char *cq = (char*)cq_ring_;
+			cq_head_    = (unsigned*)(cq + p.cq_off.head);
+			cq_tail_    = (unsigned*)(cq + p.cq_off.tail);
+			cq_mask_    = *(unsigned*)(cq + p.cq_off.ring_mask);
+			cqes_       = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+			sq_local_tail_ = *sq_tail_;
+			return true;
+		}
+
+		void close()
+		{
+			if (NULL != sqes_ && MAP_FAILED != (void*)sqes_)
+				::munmap(sqes_, sqes_sz_);
+
+			if (NULL != cq_ring_ && MAP_FAILED != cq_ring_ && cq_ring_ != sq_ring_)
+				::munmap(cq_ring_, cq_ring_sz_);
+
+			if (NULL != sq_ring_ && MAP_FAILED != sq_ring_)
+				::munmap(sq_ring_, sq_ring_sz_);
+
+			if (-1 != fd_)
+				::close(fd_);
+
+			this->reset_members();
+		}
+
+		// checks that all the opcodes we're about to use are supported by the running kernel
+		bool probe_ops(int const *ops, size_t n_ops)
+		{
+			size_t const probe_sz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+			struct io_uring_probe *probe = (struct io_uring_probe*)::calloc(1, probe_sz);
+			if (NULL == probe)
+				return false;
+
+			bool result = (0 == io_uring_register(fd_, IORING_REGISTER_PROBE, probe, 256));
+
+			for (size_t i = 0; result && i < n_ops; ++i)
+			{
+				int const op = ops[i];
+				result = (op <= probe->last_op) && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+			}
+
+			::free(probe);
+			return result;
+		}
+
+		bool register_eventfd(int efd)
+		{
+			return (0 == io_uring_register(fd_, IORING_REGISTER_EVENTFD, &efd, 1));
+		}
+
+	public: // submission
+
+		// NULL if the submission queue is full, submit() and retry
+		struct io_uring_sqe* get_sqe()
+		{
+			unsigned const head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+			if (sq_local_tail_ - head >= sq_entries_)
+				return NULL;
+
+			unsigned const idx = sq_local_tail_ & sq_mask_;
+			struct io_uring_sqe *sqe = &sqes_[idx];
+			sq_array_[idx] = idx;
+			++sq_local_tail_;
+
+			std::memset(sqe, 0, sizeof(*sqe));
+			return sqe;
+		}
+
+		// prepared, but not consumed by the kernel yet
+		//  sqes published by a submit() that failed are still counted, the next one retries them
+		unsigned sq_pending() const
+		{
+			return sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+		}
+
+		// publishes all prepared sqes and enters the kernel (if there is a reason to)
+		//  returns the number of sqes consumed or -1 and errno
+		int submit(unsigned min_complete = 0)
+		{
+			unsigned const to_submit = this->sq_pending();
+			__atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+			if (0 == to_submit && 0 == min_complete)
+				return 0;
+
+			unsigned const flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+			int r;
+			do {
+				r = io_uring_enter(fd_, to_submit, min_complete, flags);
+			} while (-1 == r && EINTR == errno);
+
+			return r;
+		}
+
+	public: // completion
+
+		unsigned cq_ready() const
+		{
+			return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+		}
+
+		struct io_uring_cqe* cq_peek(unsigned i) const
+		{
+			return &cqes_[(*cq_head_ + i) & cq_mask_];
+		}
+
+		void cq_advance(unsigned n)
+		{
+			__atomic_store_n(cq_head_, *cq_head_ + n, __ATOMIC_RELEASE);
+		}
+
+	private:
+
+		void reset_members()
+		{
+			fd_ = -1;
+			sq_ring_ = cq_ring_ = NULL;
+			sq_ring_sz_ = cq_ring_sz_ = sqes_sz_ = 0;
+			sq_head_ = sq_tail_ = sq_array_ = cq_head_ = cq_tail_ = NULL;
+			sq_mask_ = sq_entries_ = sq_local_tail_ = cq_mask_ = 0;
+			sqes_ = NULL;
+			cqes_ = NULL;
+		}
+
+		bool setup_failed()
+		{
+			int const err = errno;
+			this->close();
+			errno = err;
+			return false;
+		}
+
+	private:
+		int                  fd_;
+
+		void                *sq_ring_;
+		size_t               sq_ring_sz_;
+		unsigned            *sq_head_;
+		unsigned            *sq_tail_;
+		unsigned             sq_mask_;
+		unsigned             sq_entries_;
+		unsigned            *sq_array_;
+		unsigned             sq_local_tail_;
+
+		struct io_uring_sqe *sqes_;
+		size_t               sqes_sz_;
+
+		void                *cq_ring_;
+		size_t               cq_ring_sz_;
+		unsigned            *cq_head_;
+		unsigned            *cq_tail_;
+		unsigned             cq_mask_;
+		struct io_uring_cqe *cqes_;
+	};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace os_unix {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_UNIX__IO_URING_HPP_
@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef MEOW_UNIX__THREAD_AFFINITY_HPP_
+#define MEOW_UNIX__THREAD_AFFINITY_HPP_
+
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE // sched_getcpu, pthread_setaffinity_np
+#endif
+
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <meow/api_call_error.hpp>
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+namespace os_unix {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// cpus this process is allowed to run on
+	inline std::vector<int> process_allowed_cpus()
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (-1 == ::sched_getaffinity(0, sizeof(set), &set))
+			throw meow::api_call_error("sched_getaffinity()");
+
+		std::vector<int> result;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &set))
+				result.push_back(cpu);
+		}
+		return result;
+	}
+
+	// returns 0 or error code, doesn't throw, as it's meant to be called at thread start
+	inline int thread_set_affinity(pthread_t thr, std::vector<int> const& cpus)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+			CPU_SET(cpu, &set);
+
+		return ::pthread_setaffinity_np(thr, sizeof(set), &set);
+	}
+
+	// cpu the calling thread is on right now, -1 when unknown
+	inline int current_cpu()
+	{
+		return ::sched_getcpu();
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// topology from sysfs, -1 for whatever is not there (i.e. no numa, containers)
+
+	namespace detail {
+
+		inline int sysfs_read_int(char const *path)
+		{
+			FILE *f = ::fopen(path, "r");
+			if (NULL == f)
+				return -1;
+
+			int value = -1;
+			if (1 != ::fscanf(f, "%d", &value))
+				value = -1;
+
+			::fclose(f);
+			return value;
+		}
+
+	} // namespace detail {
+
+	struct cpu_topology_t
+	{
+		int cpu;
+		int core_id;    // unique within the package only
+		int package_id;
+		int node;       // numa node
+	};
+
+	inline cpu_topology_t cpu_topology(int cpu)
+	{
+		cpu_topology_t result = { cpu, -1, -1, -1 };
+
+		char path[128];
+		::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+		result.core_id = detail::sysfs_read_int(path);
+
+		::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		result.package_id = detail::sysfs_read_int(path);
+
+		// cpuN/nodeM symlink
+		::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+		if (DIR *d = ::opendir(path))
+		{
+			while (struct dirent *de = ::readdir(d))
+			{
+				if (0 == ::strncmp(de->d_name, "node", 4) && de->d_name[4] >= '0' && de->d_name[4] <= '9')
+				{
+					result.node = ::atoi(de->d_name + 4);
+					break;
+				}
+			}
+			::closedir(d);
+		}
+
+		return result;
+	}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+} // namespace os_unix {
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+#endif // MEOW_UNIX__THREAD_AFFINITY_HPP_
@@ -11,6 +11,7 @@
 #endif
 
 #include <sys/types.h>
+#include <fcntl.h> // open
 #include <unistd.h>
 
 #include "libc_wrapper.hpp"
@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/buffer/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o buffer_pool_perf buffer_pool_perf.cpp
+//
+// ./buffer_pool_perf [n_messages = 10000000] [window = 64]
+//
+// emulates the reader side of a message connection:
+//  header sized buffer, grown to the full message size, kept alive for a while (queued/processed), destroyed
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <meow/buffer.hpp>
+#include <meow/buffer_pool.hpp>
+#include <meow/stopwatch.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+
+namespace ff = meow::format;
+using namespace meow;
+
+static size_t const header_size = 16;
+
+template<class CreateF>
+static double run(char const *name, size_t n_messages, size_t window, CreateF const& create_f)
+{
+	std::vector<buffer_move_ptr> live(window);
+
+	// deterministic body sizes, mostly small with an occasional big one
+	unsigned seed = 12345;
+
+	stopwatch_t sw;
+
+	for (size_t i = 0; i < n_messages; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		size_t const body_size = ((seed >> 16) & 0x0f) ? (seed >> 8) % 512 : (seed >> 8) % 16384;
+
+		buffer_move_ptr b = create_f(header_size);
+		b->advance_last(header_size);
+		b->resize_to(header_size + body_size);
+		b->advance_last(body_size);
+
+		live[i % window] = move(b); // destroys the oldest one
+	}
+
+	live.clear();
+
+	double const elapsed = timeval_to_double(sw.stamp());
+	ff::fmt(stdout, "{0}: {1} messages in {2} sec, {3} ns/msg\n", name, n_messages, elapsed, (uint64_t)(elapsed * 1e9 / n_messages));
+	return elapsed;
+}
+
+int main(int argc, char **argv)
+{
+	size_t const n_messages = (argc > 1) ? atoi(argv[1]) : 10 * 1000 * 1000;
+	size_t const window     = (argc > 2) ? atoi(argv[2]) : 64;
+
+	double const t_malloc = run("create_buffer", n_messages, window, [](size_t sz) { return create_buffer(sz); });
+	double const t_pool   = run("create_buffer_from_pool", n_messages, window, [](size_t sz) { return create_buffer_from_pool(sz); });
+
+	buffer_pool_stats_t const st = buffer_pool_t::this_thread()->stats();
+	ff::fmt(stdout, "pool: hits: {0}, misses: {1}, releases: {2}, drops: {3}, bytes_retained: {4}\n"
+			, st.hits, st.misses, st.releases, st.drops, st.bytes_retained);
+	ff::fmt(stdout, "speedup: {0}\n", t_malloc / t_pool);
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o async_work_stealing_perf async_work_stealing_perf.cpp -lev -pthread
+//
+// ./async_work_stealing_perf [tasks = 2000] [workers = 4] [slow_every = 16] [slow_us = 20000]
+//
+// blocking tasks, every slow_every-th is slow and the rest take 100us
+//  round robin over threaded executors (one thread each) vs the work stealing executor with as many threads
+//  the time is from the first run_task() till the last task_finished() on the main loop
+//  with round robin, the fast tasks wait behind slow ones on the same executor
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/async_task.hpp>
+
+namespace ff = meow::format;
+using namespace meow::libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct sleep_task_t : public async_task_t
+{
+	size_t  sleep_us;
+	size_t *n_left;
+
+	sleep_task_t(size_t us, size_t *left)
+		: sleep_us(us)
+		, n_left(left)
+	{
+	}
+
+	virtual void do_task_run() override
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+		this->task_finalize();
+	}
+
+	virtual void do_task_abort() override
+	{
+	}
+
+	virtual void do_finished() override
+	{
+		if (0 == --(*n_left))
+			ev_break(this->loop(), EVBREAK_ALL);
+	}
+};
+
+template<class Executor>
+static double run(evloop_t *loop, Executor& executor, size_t n_tasks, size_t slow_every, size_t slow_us)
+{
+	size_t n_left = n_tasks;
+	meow::stopwatch_t sw;
+
+	for (size_t i = 0; i < n_tasks; ++i)
+	{
+		size_t const us = (0 == (i % slow_every)) ? slow_us : 100;
+		executor.run_task(async_task_ptr(new sleep_task_t(us, &n_left)));
+	}
+
+	ev_run(loop, 0);
+	return timeval_to_double(sw.stamp());
+}
+
+int main(int argc, char **argv)
+{
+	size_t const n_tasks    = (argc > 1) ? atoi(argv[1]) : 2000;
+	size_t const n_workers  = (argc > 2) ? atoi(argv[2]) : 4;
+	size_t const slow_every = (argc > 3) ? atoi(argv[3]) : 16;
+	size_t const slow_us    = (argc > 4) ? atoi(argv[4]) : 20000;
+
+	ff::fmt(stdout, "tasks: {0}, workers: {1}, slow_every: {2}, slow_us: {3}\n", n_tasks, n_workers, slow_every, slow_us);
+
+	evloop_t *loop = ev_loop_new(EVFLAG_AUTO);
+
+	{
+		async_scheduler___round_robin_t scheduler;
+		for (size_t i = 0; i < n_workers; ++i)
+		{
+			async_executor_ptr e(new async_executor___threaded_t(loop));
+			e->startup();
+			scheduler.add_executor(move(e));
+		}
+
+		double const elapsed = run(loop, scheduler, n_tasks, slow_every, slow_us);
+		ff::fmt(stdout, "round_robin: {0} sec\n", elapsed);
+	}
+
+	{
+		async_executor___work_stealing_t executor(loop, n_workers);
+		executor.startup();
+
+		double const elapsed = run(loop, executor, n_tasks, slow_every, slow_us);
+		ff::fmt(stdout, "work_stealing: {0} sec\n", elapsed);
+
+		std::vector<async_worker_stats_t> const stats = executor.stats();
+		for (size_t i = 0; i < stats.size(); ++i)
+			ff::fmt(stdout, "  worker {0}: tasks_run: {1}, steals: {2}\n", i, stats[i].tasks_run, stats[i].steals);
+	}
+
+	ev_loop_destroy(loop);
+	return 0;
+}
@@ -0,0 +1,223 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o epoll_ctl_churn_perf epoll_ctl_churn_perf.cpp -lev -pthread
+//
+// ./epoll_ctl_churn_perf [requests = 20000] [response_size = 65536]
+//
+// request/response over socketpairs, with responses larger than the socket send buffer
+//  so that every response blocks the write and the connection waits for EV_WRITE
+// epoll_ctl() and epoll_wait() calls made by libev are counted by overriding them here
+//  for a few option_write_wait_linger values, 0 is the default (no lingering)
+//  with 1 and 8 connections (and client threads) on the loop
+//
+// lingering is counted in loop wakeups, a lone connection spins through them before the next request arrives
+//  with several busy connections on the loop, the wakeups happen anyway and the linger spans more time
+//
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <meow/buffer_pool.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/detail/generic_connection_impl.hpp>
+
+namespace ff = meow::format;
+namespace libev = meow::libev;
+using namespace libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<uint64_t> n_epoll_ctl(0);
+static std::atomic<uint64_t> n_epoll_wait(0);
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+	++n_epoll_ctl;
+	return ::syscall(SYS_epoll_ctl, epfd, op, fd, ev);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	++n_epoll_wait;
+	return ::syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, NULL, 8);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct server_connection_t;
+
+struct server_events_t
+{
+	void on_closed(server_connection_t *c, io_close_report_t const&) {}
+};
+
+struct server_connection_t : public generic_connection_e_t<server_events_t>
+{
+	size_t  response_size;
+	size_t  *requests_left; // for the whole loop
+	char    rbuf[64];
+};
+
+template<size_t Linger>
+struct linger_traits
+{
+	struct option_write_wait_linger { enum { value = Linger }; };
+
+	struct read
+	{
+		struct context_t {};
+
+		template<class ContextT>
+		static meow::buffer_ref get_buffer(ContextT *ctx) { return meow::buffer_ref(ctx->rbuf, sizeof(ctx->rbuf)); }
+
+		// a byte per request
+		template<class ContextT>
+		static rd_consume_status_t consume_buffer(ContextT *ctx, meow::buffer_ref read_part, read_status_t)
+		{
+			for (size_t i = 0; i < read_part.size(); ++i)
+			{
+				meow::buffer_move_ptr b = meow::create_buffer_from_pool(ctx->response_size);
+				b->advance_last(ctx->response_size);
+				ctx->queue_buf(move(b));
+
+				if (0 == --*ctx->requests_left)
+					ev_break(ctx->loop(), EVBREAK_ALL);
+			}
+			return rd_consume_status::more;
+		}
+	};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct result_t
+{
+	double epoll_ctl_per_request;
+	double epoll_wait_per_request;
+	double ns_per_request;
+};
+
+template<class Traits>
+static result_t run(size_t n_conns, size_t requests, size_t response_size)
+{
+	typedef generic_connection_impl_t<server_connection_t, Traits> conn_t;
+
+	evloop_t *loop = ev_loop_new(EVBACKEND_EPOLL);
+	server_events_t ev;
+
+	// clients keep sending till the server is done, so that nobody is left alone at the end
+	size_t requests_left = requests;
+	std::atomic<bool> done(false);
+
+	std::vector<conn_t*> conns;
+	std::vector<int> client_fds;
+	std::vector<std::thread> clients;
+
+	for (size_t i = 0; i < n_conns; ++i)
+	{
+		int sv[2];
+		::socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+
+		int sndbuf = 16 * 1024;
+		::setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+		conn_t *c = new conn_t(loop, sv[0], &ev);
+		c->response_size = response_size;
+		c->requests_left = &requests_left;
+		c->r_activate();
+		conns.push_back(c);
+
+		int const fd = sv[1];
+		client_fds.push_back(fd);
+
+		clients.emplace_back([fd, response_size, &done]()
+		{
+			std::vector<char> buf(response_size);
+			while (!done)
+			{
+				char const req = 'r';
+				if (1 != ::write(fd, &req, 1))
+					break;
+
+				size_t got = 0;
+				while (got < response_size)
+				{
+					ssize_t n = ::read(fd, buf.data(), response_size - got);
+					if (n <= 0)
+						return;
+					got += n;
+				}
+			}
+		});
+	}
+
+	uint64_t const ctl_before = n_epoll_ctl;
+	uint64_t const wait_before = n_epoll_wait;
+	meow::stopwatch_t sw;
+
+	ev_run(loop, 0);
+
+	double const elapsed = timeval_to_double(sw.stamp());
+	uint64_t const ctl = n_epoll_ctl - ctl_before;
+	uint64_t const waits = n_epoll_wait - wait_before;
+
+	// clients may wait for a response that never comes, shutdown() wakes them up
+	done = true;
+	for (conn_t *c : conns)
+		delete c;
+	for (int fd : client_fds)
+		::shutdown(fd, SHUT_RDWR);
+	for (std::thread& t : clients)
+		t.join();
+	for (int fd : client_fds)
+		::close(fd);
+
+	ev_loop_destroy(loop);
+
+	result_t r;
+	r.epoll_ctl_per_request = double(ctl) / requests;
+	r.epoll_wait_per_request = double(waits) / requests;
+	r.ns_per_request = elapsed * 1e9 / requests;
+	return r;
+}
+
+template<size_t Linger>
+static void run_and_print(size_t n_conns, size_t requests, size_t response_size)
+{
+	result_t const r = run<linger_traits<Linger> >(n_conns, requests, response_size);
+	ff::fmt(stdout, "{0} {1} {2} {3} {4}\n", n_conns, Linger, r.epoll_ctl_per_request, r.epoll_wait_per_request, (uint64_t)r.ns_per_request);
+}
+
+int main(int argc, char **argv)
+{
+	size_t const requests      = (argc > 1) ? atoi(argv[1]) : 20000;
+	size_t const response_size = (argc > 2) ? atoi(argv[2]) : 65536;
+
+	ff::fmt(stdout, "requests: {0}, response_size: {1}\n", requests, response_size);
+	ff::fmt(stdout, "{0} {1} {2} {3} {4}\n", "conns", "linger", "epoll_ctl/req", "epoll_wait/req", "ns/req");
+
+	for (size_t n_conns : { 1, 8 })
+	{
+		run_and_print<0>(n_conns, requests, response_size);
+		run_and_print<1>(n_conns, requests, response_size);
+		run_and_print<4>(n_conns, requests, response_size);
+		run_and_print<16>(n_conns, requests, response_size);
+	}
+
+	return 0;
+}
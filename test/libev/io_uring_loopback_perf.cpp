@@ -0,0 +1,257 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o io_uring_loopback_perf io_uring_loopback_perf.cpp -lev -pthread
+//
+// ./io_uring_loopback_perf [epoll|uring] [n_clients = 64] [seconds = 3] [msg_size = 64]
+//
+// echo server on the main thread, blocking ping-pong clients on their own threads, over tcp loopback
+// server side syscalls are counted as:
+//   read+write class syscalls of the loop thread (/proc/thread-self/io: syscr, syscw)
+//   + loop iterations (one epoll_wait each) + io_uring_enter() calls
+// epoll_ctl() calls are not visible this way and are not included
+//
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/io_uring_machine.hpp>
+#include <meow/libev/detail/generic_connection_impl.hpp>
+
+namespace ff = meow::format;
+namespace libev = meow::libev;
+using namespace libev;
+using meow::buffer_ref;
+using meow::buffer_move_ptr;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct echo_connection_t;
+
+struct echo_events_t
+{
+	size_t n_open = 0;
+	evloop_t *loop = NULL;
+
+	void on_closed(echo_connection_t *c, io_close_report_t const&);
+};
+
+struct echo_connection_t : public generic_connection_e_t<echo_events_t>
+{
+};
+
+template<class Engine>
+struct echo_traits
+{
+	typedef Engine io_engine;
+
+	struct read
+	{
+		struct context_t
+		{
+			buffer_move_ptr r_buf;
+		};
+
+		template<class ContextT>
+		static buffer_ref get_buffer(ContextT *ctx)
+		{
+			if (!ctx->r_buf)
+				ctx->r_buf = meow::create_buffer(4096);
+			return ctx->r_buf->free_part();
+		}
+
+		template<class ContextT>
+		static rd_consume_status_t consume_buffer(ContextT *ctx, buffer_ref read_part, read_status_t r_status)
+		{
+			if (read_status::error == r_status)
+			{
+				ctx->cb_read_closed(io_close_report(io_close_reason::io_error, errno));
+				return rd_consume_status::closed;
+			}
+
+			if (!read_part.empty())
+				ctx->queue_buf(meow::buffer_create_with_data(read_part.data(), read_part.size()));
+
+			if (read_status::closed == r_status)
+			{
+				ctx->cb_read_closed(io_close_report(io_close_reason::peer_close));
+				return rd_consume_status::closed;
+			}
+
+			return rd_consume_status::more;
+		}
+	};
+};
+
+void echo_events_t::on_closed(echo_connection_t *c, io_close_report_t const&)
+{
+	delete c;
+
+	if (0 == --n_open)
+		libev::break_loop(loop);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct thread_io_t
+{
+	uint64_t syscr = 0;
+	uint64_t syscw = 0;
+
+	static thread_io_t now()
+	{
+		thread_io_t r;
+		if (FILE *f = fopen("/proc/thread-self/io", "r"))
+		{
+			char name[64];
+			unsigned long long v;
+			while (2 == fscanf(f, "%63[^:]: %llu\n", name, &v))
+			{
+				if (0 == strcmp(name, "syscr")) r.syscr = v;
+				if (0 == strcmp(name, "syscw")) r.syscw = v;
+			}
+			fclose(f);
+		}
+		return r;
+	}
+};
+
+template<class Engine>
+static void run_server(evloop_t *loop, std::vector<int> const& fds, echo_events_t *ev)
+{
+	typedef generic_connection_impl_t<echo_connection_t, echo_traits<Engine> > conn_t;
+
+	for (int fd : fds)
+	{
+		echo_connection_t *c = new conn_t(loop, fd, ev);
+		c->r_activate();
+	}
+
+	libev::run_loop(loop);
+}
+
+int main(int argc, char **argv)
+{
+	bool const use_uring  = (argc > 1) && (0 == strcmp(argv[1], "uring"));
+	size_t const n_clients = (argc > 2) ? atoi(argv[2]) : 64;
+	int const seconds      = (argc > 3) ? atoi(argv[3]) : 3;
+	size_t const msg_size  = (argc > 4) ? atoi(argv[4]) : 64;
+
+	int ls = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t sa_len = sizeof(sa);
+	::bind(ls, (struct sockaddr*)&sa, sizeof(sa));
+	::listen(ls, n_clients);
+	::getsockname(ls, (struct sockaddr*)&sa, &sa_len);
+
+	std::atomic<bool>     stop { false };
+	std::atomic<uint64_t> n_requests { 0 };
+	std::vector<std::thread> clients;
+
+	for (size_t i = 0; i < n_clients; i++)
+	{
+		clients.emplace_back([&]()
+		{
+			int s = ::socket(AF_INET, SOCK_STREAM, 0);
+			int one = 1;
+			::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			if (0 != ::connect(s, (struct sockaddr*)&sa, sizeof(sa)))
+				return;
+
+			std::vector<char> buf(msg_size, 'x');
+			uint64_t n = 0;
+
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				if ((ssize_t)msg_size != ::write(s, buf.data(), msg_size))
+					break;
+
+				size_t got = 0;
+				while (got < msg_size)
+				{
+					ssize_t r = ::read(s, buf.data() + got, msg_size - got);
+					if (r <= 0)
+						goto out;
+					got += r;
+				}
+				n++;
+			}
+		out:
+			n_requests += n;
+			::close(s);
+		});
+	}
+
+	std::vector<int> fds;
+	for (size_t i = 0; i < n_clients; i++)
+	{
+		int fd = ::accept(ls, NULL, NULL);
+		int one = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		fds.push_back(fd);
+	}
+	::close(ls);
+
+	evloop_default_t loop = libev::create_default_loop(EVFLAG_AUTO | EVFLAG_NOENV);
+
+	io_uring_loop_ptr uring;
+	if (use_uring)
+	{
+		uring.reset(new io_uring_loop_t(get_handle(loop)));
+		if (!uring->is_enabled())
+			ff::fmt(stdout, "io_uring is not available: {0}, falling back to readiness io\n", strerror(errno));
+	}
+
+	std::thread stopper([&]() { sleep(seconds); stop = true; });
+
+	echo_events_t ev;
+	ev.n_open = fds.size();
+	ev.loop = get_handle(loop);
+
+	thread_io_t const io_before = thread_io_t::now();
+	unsigned const iter_before = ev_iteration(get_handle(loop));
+	meow::stopwatch_t sw;
+
+	if (use_uring)
+		run_server<io_uring_machine_engine_t>(get_handle(loop), fds, &ev);
+	else
+		run_server<io_machine_engine_t>(get_handle(loop), fds, &ev);
+
+	double const elapsed = timeval_to_double(sw.stamp());
+	thread_io_t const io_after = thread_io_t::now();
+	unsigned const iterations = ev_iteration(get_handle(loop)) - iter_before;
+
+	stopper.join();
+	for (auto& t : clients)
+		t.join();
+
+	uint64_t const enter_calls = (uring && uring->is_enabled()) ? uring->stats().enter_calls : 0;
+	uint64_t const rw_calls = (io_after.syscr - io_before.syscr) + (io_after.syscw - io_before.syscw);
+	uint64_t const total_calls = rw_calls + iterations + enter_calls;
+	uint64_t const reqs = n_requests.load();
+
+	ff::fmt(stdout, "engine: {0}, clients: {1}, msg_size: {2}\n", (use_uring ? "uring" : "epoll"), n_clients, msg_size);
+	ff::fmt(stdout, "requests: {0}, req/s: {1}\n", reqs, (uint64_t)(reqs / elapsed));
+	ff::fmt(stdout, "syscalls: read/write: {0}, loop iterations: {1}, io_uring_enter: {2}\n", rw_calls, iterations, enter_calls);
+	ff::fmt(stdout, "syscalls/request: {0}\n", (reqs ? double(total_calls) / reqs : 0.));
+
+	return 0;
+}
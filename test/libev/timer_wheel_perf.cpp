@@ -0,0 +1,85 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o timer_wheel_perf timer_wheel_perf.cpp -lev
+//
+// ./timer_wheel_perf [timers = 1000000] [resets = 10]
+//
+// a timer per connection, set to a random timeout, then reset a few times (like an idle timeout on activity)
+//  and deleted, nothing fires as the loop is not run
+// single level bounded_timer_impl_t with 1s ticks (it can't do 1ms ticks for an hour, the array is too big)
+//  vs hierarchical_timer_impl_t with 1ms ticks, timeouts from 1ms to 1h for both
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/bounded_timer_impl.hpp>
+#include <meow/libev/hierarchical_timer_impl.hpp>
+
+namespace ff = meow::format;
+using namespace meow::libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void run(char const *name, bounded_timer_t *timer, size_t n_timers, size_t n_resets)
+{
+	std::vector<bounded_timer_node_t> nodes(n_timers);
+	for (auto& node : nodes)
+		node.timer_callback = [](bounded_timer_t*, bounded_timer_node_t*, bounded_timer_timestamp_t) {};
+
+	std::vector<double> timeouts(n_timers);
+	for (auto& ts : timeouts)
+		ts = 0.001 * (1 + (::random() % 3600000));
+
+	meow::stopwatch_t sw;
+
+	for (size_t i = 0; i < n_timers; ++i)
+		timer->timer_set(&nodes[i], timeouts[i]);
+
+	for (size_t r = 0; r < n_resets; ++r)
+	{
+		for (size_t i = 0; i < n_timers; ++i)
+			timer->timer_set(&nodes[i], timeouts[(i + r) % n_timers]);
+	}
+
+	for (size_t i = 0; i < n_timers; ++i)
+		timer->timer_del(&nodes[i]);
+
+	double const elapsed = timeval_to_double(sw.stamp());
+	size_t const n_ops = n_timers * (n_resets + 2);
+
+	ff::fmt(stdout, "{0} {1} ops/sec, {2} nsec/op\n", name, (uint64_t)(n_ops / elapsed), elapsed * 1e9 / n_ops);
+}
+
+int main(int argc, char **argv)
+{
+	size_t const n_timers = (argc > 1) ? atoi(argv[1]) : 1000000;
+	size_t const n_resets = (argc > 2) ? atoi(argv[2]) : 10;
+
+	ff::fmt(stdout, "timers: {0}, resets: {1}\n", n_timers, n_resets);
+
+	evloop_t *loop = ev_loop_new(EVFLAG_AUTO);
+
+	{
+		auto timer = meow::make_unique<bounded_timer_impl_t<3601, 1000>>(loop);
+		run("single_level_1s", timer.get(), n_timers, n_resets);
+	}
+
+	{
+		auto timer = meow::make_unique<hierarchical_timer_impl_t<1>>(loop);
+		run("hierarchical_1ms", timer.get(), n_timers, n_resets);
+	}
+
+	ev_loop_destroy(loop);
+	return 0;
+}
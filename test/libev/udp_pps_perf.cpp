@@ -0,0 +1,155 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o udp_pps_perf udp_pps_perf.cpp -lev
+//
+// ./udp_pps_perf [datagrams = 1000000] [size = 64] [burst = 256]
+//
+// two datagram endpoints on one loop over loopback
+//  the sender queues a burst per loop iteration, if no more than a burst is in flight
+//  the receiver counts what it gets, datagrams dropped by the kernel are not retried
+//  for batch 1 (a syscall per datagram), 32 and 32 with UDP_SEGMENT
+//
+
+#include <sys/socket.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <meow/buffer_pool.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/datagram_endpoint_impl.hpp>
+
+namespace ff = meow::format;
+namespace libev = meow::libev;
+using namespace libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+template<size_t Batch, bool Gso>
+struct udp_traits
+{
+	struct option_datagram_batch { enum { value = Batch }; };
+	struct option_udp_segment { enum { value = Gso }; };
+};
+
+struct counter_t : public datagram_endpoint_t::events_t
+{
+	uint64_t received = 0;
+	uint64_t errors = 0;
+
+	virtual void on_datagrams(datagram_endpoint_t*, datagram_t *dgrams, size_t n_dgrams) override
+	{
+		received += n_dgrams;
+	}
+
+	virtual void on_error(datagram_endpoint_t*, int err) override
+	{
+		++errors;
+	}
+};
+
+struct sender_t
+{
+	datagram_endpoint_t *ep;
+	counter_t const     *receiver;
+	ipv4::address_t      to;
+	size_t               size;
+	size_t               burst;
+	size_t               total;
+	size_t               left;
+	evprepare_t          ev;
+
+	// a burst every loop iteration, while the receiver keeps up
+	static void libev_cb(evloop_t *loop, evprepare_t *ev, int)
+	{
+		sender_t *self = static_cast<sender_t*>(ev->data);
+
+		size_t const in_flight = (self->total - self->left) - self->receiver->received;
+		if (in_flight >= self->burst)
+			return;
+
+		for (size_t i = 0; i < self->burst && self->left > 0; ++i, --self->left)
+		{
+			meow::buffer_move_ptr b = meow::create_buffer_from_pool(self->size);
+			b->advance_last(self->size);
+			self->ep->send(self->to, move(b));
+		}
+
+		if (0 == self->left)
+			ev_prepare_stop(loop, ev);
+	}
+};
+
+template<class Traits>
+static void run(char const *name, size_t n_dgrams, size_t size, size_t burst)
+{
+	evloop_t *loop = ev_loop_new(EVFLAG_AUTO);
+
+	counter_t rx_events, tx_events;
+	datagram_endpoint_move_ptr rx = start_datagram_endpoint<Traits>(loop, ipv4::address_t(INADDR_LOOPBACK, 0), &rx_events);
+	datagram_endpoint_move_ptr tx = start_datagram_endpoint<Traits>(loop, ipv4::address_t(INADDR_LOOPBACK, 0), &tx_events);
+
+	int rcvbuf = 8 * 1024 * 1024;
+	::setsockopt(rx->fd(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	sender_t sender = { tx.get(), &rx_events, rx->local_address(), size, burst, n_dgrams, n_dgrams };
+	ev_prepare_init(&sender.ev, &sender_t::libev_cb);
+	sender.ev.data = &sender;
+	ev_prepare_start(loop, &sender.ev);
+
+	meow::stopwatch_t sw;
+
+	// a dropped datagram stays in flight forever, give up when nothing comes for a bit
+	uint64_t prev_received = 0;
+	size_t idle_runs = 0;
+	while (rx_events.received < n_dgrams && idle_runs < 1000)
+	{
+		ev_run(loop, EVRUN_NOWAIT);
+
+		idle_runs = (rx_events.received == prev_received) ? idle_runs + 1 : 0;
+		prev_received = rx_events.received;
+	}
+
+	double const elapsed = timeval_to_double(sw.stamp());
+
+	datagram_endpoint_t::stats_t const& txs = tx->stats();
+	datagram_endpoint_t::stats_t const& rxs = rx->stats();
+
+	ff::fmt(stdout, "{0} {1} {2} {3} {4} {5}\n"
+			, name
+			, (uint64_t)(rx_events.received / elapsed)
+			, double(txs.tx_datagrams) / txs.tx_syscalls
+			, double(rxs.rx_datagrams) / rxs.rx_syscalls
+			, txs.tx_segmented
+			, n_dgrams - rx_events.received
+			);
+
+	ev_prepare_stop(loop, &sender.ev);
+	rx.reset();
+	tx.reset();
+	ev_loop_destroy(loop);
+}
+
+int main(int argc, char **argv)
+{
+	size_t const n_dgrams = (argc > 1) ? atoi(argv[1]) : 1000000;
+	size_t const size     = (argc > 2) ? atoi(argv[2]) : 64;
+	size_t const burst    = (argc > 3) ? atoi(argv[3]) : 256;
+
+	ff::fmt(stdout, "datagrams: {0}, size: {1}, burst: {2}\n", n_dgrams, size, burst);
+	ff::fmt(stdout, "{0} {1} {2} {3} {4} {5}\n", "mode", "pps", "tx_dgrams/syscall", "rx_dgrams/syscall", "tx_segmented", "lost");
+
+	run<udp_traits<1, false> >("batch_1", n_dgrams, size, burst);
+	run<udp_traits<32, false> >("batch_32", n_dgrams, size, burst);
+	run<udp_traits<32, true> >("batch_32_gso", n_dgrams, size, burst);
+
+	return 0;
+}
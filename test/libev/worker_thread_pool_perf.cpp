@@ -0,0 +1,268 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o worker_thread_pool_perf worker_thread_pool_perf.cpp -lev -pthread
+//
+// ./worker_thread_pool_perf [jobs = 1000000] [threads = 4] [batch = 64]
+//
+// empty jobs, workers_schedule() -> work() on a thread -> callback() on the loop
+//  throughput: all the jobs are scheduled upfront (by one, or in batches), time till the last callback
+//  latency: one job at a time, the next is scheduled from the callback of the previous one
+// for workers_t and the mutex + condition variable pool it had before (mutex_workers_t below)
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/worker_thread_pool.hpp>
+
+namespace ff = meow::format;
+using namespace meow::libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+// the previous implementation, a queue under a mutex each way and a wakeup per result
+
+struct mutex_workers_t
+{
+	using item_t = meow::worker_item_ptr;
+
+	evloop_t                  *loop;
+	evasync_t                  ev;
+
+	std::mutex                 r_lock;
+	std::deque<item_t>         r_queue;
+
+	std::vector<std::thread>   t;
+	std::mutex                 w_lock;
+	std::condition_variable    w_cond;
+	std::deque<item_t>         w_queue;
+	bool                       shutting_down = false;
+
+	mutex_workers_t(evloop_t *l, size_t n)
+		: loop(l)
+	{
+		ev.data = this;
+		ev_async_init(&ev, [](evloop_t*, evasync_t *ev, int)
+		{
+			auto self = static_cast<mutex_workers_t*>(ev->data);
+
+			std::deque<item_t> q;
+			{
+				std::lock_guard<std::mutex> g_{ self->r_lock };
+				q.swap(self->r_queue);
+			}
+
+			for (auto& item : q)
+				item->callback();
+		});
+		ev_async_start(loop, &ev);
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			t.emplace_back([this]()
+			{
+				while (true)
+				{
+					item_t item;
+					{
+						std::unique_lock<std::mutex> lk_ { w_lock };
+						w_cond.wait(lk_, [&]() { return shutting_down || !w_queue.empty(); });
+						if (w_queue.empty())
+							break;
+
+						item = std::move(w_queue.front());
+						w_queue.pop_front();
+					}
+
+					item->work();
+
+					{
+						std::lock_guard<std::mutex> g_{ r_lock };
+						r_queue.push_back(std::move(item));
+					}
+
+					ev_async_send(loop, &ev);
+				}
+			});
+		}
+	}
+
+	~mutex_workers_t()
+	{
+		{
+			std::lock_guard<std::mutex> g_{ w_lock };
+			shutting_down = true;
+		}
+		w_cond.notify_all();
+
+		for (auto& thr : t)
+			thr.join();
+
+		ev_async_stop(loop, &ev);
+	}
+
+	template<class T, class WF, class CF>
+	void schedule(T&& state, WF const& work, CF const& callback)
+	{
+		auto item = meow::make_unique<meow::worker_item_impl_t<T, WF, CF>>(std::forward<T>(state), work, callback);
+		{
+			std::lock_guard<std::mutex> g_{ w_lock };
+			w_queue.push_back(std::move(item));
+		}
+		w_cond.notify_one();
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct counter_t
+{
+	evloop_t *loop;
+	size_t    n_left;
+
+	void done()
+	{
+		if (0 == --n_left)
+			ev_break(loop, EVBREAK_ALL);
+	}
+};
+
+static void report(char const *name, size_t n_jobs, double elapsed)
+{
+	ff::fmt(stdout, "{0} {1} jobs/sec, {2} usec/job\n", name, (uint64_t)(n_jobs / elapsed), elapsed * 1e6 / n_jobs);
+}
+
+static void run_mutex(evloop_t *loop, size_t n_jobs, size_t n_threads)
+{
+	mutex_workers_t workers(loop, n_threads);
+
+	auto const work = [](counter_t*) {};
+	auto const callback = [](counter_t *c) { c->done(); };
+
+	{
+		counter_t c = { loop, n_jobs };
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_jobs; ++i)
+			workers.schedule(&c, work, callback);
+
+		ev_run(loop, 0);
+		report("mutex throughput", n_jobs, timeval_to_double(sw.stamp()));
+	}
+
+	{
+		struct latency_t : public counter_t
+		{
+			mutex_workers_t *workers;
+		};
+
+		size_t const n_latency = n_jobs / 10;
+		latency_t c;
+		c.loop = loop;
+		c.n_left = n_latency;
+		c.workers = &workers;
+		meow::stopwatch_t sw;
+
+		struct next_t
+		{
+			void operator()(latency_t *c) const
+			{
+				c->done();
+				if (c->n_left > 0)
+					c->workers->schedule(c, [](latency_t*) {}, next_t());
+			}
+		};
+		workers.schedule(&c, [](latency_t*) {}, next_t());
+
+		ev_run(loop, 0);
+		report("mutex latency", n_latency, timeval_to_double(sw.stamp()));
+	}
+}
+
+static void run_lockfree(evloop_t *loop, size_t n_jobs, size_t n_threads, size_t batch)
+{
+	meow::workers_ptr workers = meow::workers_init(loop, n_threads);
+
+	auto const work = [](counter_t*) {};
+	auto const callback = [](counter_t *c) { c->done(); };
+
+	{
+		counter_t c = { loop, n_jobs };
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_jobs; ++i)
+			meow::workers_schedule(*workers, &c, work, callback);
+
+		ev_run(loop, 0);
+		report("lockfree throughput", n_jobs, timeval_to_double(sw.stamp()));
+	}
+
+	{
+		counter_t c = { loop, n_jobs };
+		std::vector<counter_t*> states(batch, &c);
+		meow::stopwatch_t sw;
+
+		for (size_t i = 0; i < n_jobs; i += batch)
+			meow::workers_schedule_batch(*workers, states.begin(), states.begin() + std::min(batch, n_jobs - i), work, callback);
+
+		ev_run(loop, 0);
+		report("lockfree batched throughput", n_jobs, timeval_to_double(sw.stamp()));
+	}
+
+	{
+		struct latency_t : public counter_t
+		{
+			meow::workers_t *workers;
+		};
+
+		size_t const n_latency = n_jobs / 10;
+		latency_t c;
+		c.loop = loop;
+		c.n_left = n_latency;
+		c.workers = workers.get();
+		meow::stopwatch_t sw;
+
+		struct next_t
+		{
+			void operator()(latency_t *c) const
+			{
+				c->done();
+				if (c->n_left > 0)
+					meow::workers_schedule(*c->workers, c, [](latency_t*) {}, next_t());
+			}
+		};
+		meow::workers_schedule(*workers, &c, [](latency_t*) {}, next_t());
+
+		ev_run(loop, 0);
+		report("lockfree latency", n_latency, timeval_to_double(sw.stamp()));
+	}
+
+	meow::workers_shutdown(*workers);
+	ev_async_stop(loop, &workers->ev);
+}
+
+int main(int argc, char **argv)
+{
+	size_t const n_jobs    = (argc > 1) ? atoi(argv[1]) : 1000000;
+	size_t const n_threads = (argc > 2) ? atoi(argv[2]) : 4;
+	size_t const batch     = (argc > 3) ? atoi(argv[3]) : 64;
+
+	ff::fmt(stdout, "jobs: {0}, threads: {1}, batch: {2}\n", n_jobs, n_threads, batch);
+
+	evloop_t *loop = ev_loop_new(EVFLAG_AUTO);
+
+	run_mutex(loop, n_jobs, n_threads);
+	run_lockfree(loop, n_jobs, n_threads, batch);
+
+	ev_loop_destroy(loop);
+	return 0;
+}
@@ -0,0 +1,197 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o writev_small_buffers_perf writev_small_buffers_perf.cpp -lev -pthread
+//
+// ./writev_small_buffers_perf [n_bufs = 200] [buf_size = 64] [flushes = 20000]
+//
+// a pipelined client's worth of small responses queued at once, then flushed with one write run
+//  for a few option_writev_max_bufs values, 8 is what writev_from_wchain() used to be limited to
+//  the reader is a separate thread doing blocking reads over tcp loopback
+//  write syscalls are taken from /proc/thread-self/io (syscw) of the writing thread
+//
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <meow/buffer_pool.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/detail/generic_connection_impl.hpp>
+
+namespace ff = meow::format;
+namespace libev = meow::libev;
+using namespace libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct sink_connection_t;
+
+struct sink_events_t
+{
+	void on_closed(sink_connection_t *c, io_close_report_t const&) {}
+};
+
+struct sink_connection_t : public generic_connection_e_t<sink_events_t>
+{
+};
+
+template<size_t MaxBufs>
+struct max_bufs_traits
+{
+	struct option_writev_max_bufs { enum { value = MaxBufs }; };
+
+	struct read
+	{
+		struct context_t {};
+
+		template<class ContextT>
+		static meow::buffer_ref get_buffer(ContextT *ctx) { return meow::buffer_ref(); }
+
+		template<class ContextT>
+		static rd_consume_status_t consume_buffer(ContextT*, meow::buffer_ref, read_status_t) { return rd_consume_status::loop_break; }
+	};
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t thread_syscw()
+{
+	uint64_t r = 0;
+	if (FILE *f = fopen("/proc/thread-self/io", "r"))
+	{
+		char name[64];
+		unsigned long long v;
+		while (2 == fscanf(f, "%63[^:]: %llu\n", name, &v))
+		{
+			if (0 == strcmp(name, "syscw"))
+				r = v;
+		}
+		fclose(f);
+	}
+	return r;
+}
+
+struct result_t
+{
+	double syscalls_per_flush;
+	double ns_per_flush;
+};
+
+template<class Traits>
+static result_t run(evloop_t *loop, size_t n_bufs, size_t buf_size, size_t flushes)
+{
+	int ls = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t sa_len = sizeof(sa);
+	::bind(ls, (struct sockaddr*)&sa, sizeof(sa));
+	::listen(ls, 1);
+	::getsockname(ls, (struct sockaddr*)&sa, &sa_len);
+
+	uint64_t const total = uint64_t(n_bufs) * buf_size * flushes;
+
+	std::thread reader([&]()
+	{
+		int s = ::socket(AF_INET, SOCK_STREAM, 0);
+		::connect(s, (struct sockaddr*)&sa, sizeof(sa));
+
+		std::vector<char> buf(1024 * 1024);
+		uint64_t got = 0;
+		while (got < total)
+		{
+			ssize_t n = ::read(s, buf.data(), buf.size());
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		::close(s);
+	});
+
+	int fd = ::accept(ls, NULL, NULL);
+	::close(ls);
+
+	int one = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	sink_events_t ev;
+	typedef generic_connection_impl_t<sink_connection_t, Traits> conn_t;
+	conn_t *c = new conn_t(loop, fd, &ev);
+
+	uint64_t const syscw_before = thread_syscw();
+	meow::stopwatch_t sw;
+
+	for (size_t i = 0; i < flushes; ++i)
+	{
+		for (size_t j = 0; j < n_bufs; ++j)
+		{
+			meow::buffer_move_ptr b = meow::create_buffer_from_pool(buf_size);
+			b->advance_last(buf_size);
+			c->queue_buf(move(b));
+		}
+
+		c->run_loop(EV_WRITE);
+
+		// socket buffer is full, wait for the reader to catch up
+		while (!c->wchain_ref().empty())
+		{
+			struct pollfd pfd = { fd, POLLOUT, 0 };
+			::poll(&pfd, 1, -1);
+			c->run_loop(EV_WRITE);
+		}
+	}
+
+	double const elapsed = timeval_to_double(sw.stamp());
+	uint64_t const syscw = thread_syscw() - syscw_before;
+
+	reader.join();
+
+	delete c;
+	::close(fd);
+
+	result_t r;
+	r.syscalls_per_flush = double(syscw) / flushes;
+	r.ns_per_flush = elapsed * 1e9 / flushes;
+	return r;
+}
+
+template<size_t MaxBufs>
+static void run_and_print(evloop_t *loop, size_t n_bufs, size_t buf_size, size_t flushes)
+{
+	result_t const r = run<max_bufs_traits<MaxBufs> >(loop, n_bufs, buf_size, flushes);
+	ff::fmt(stdout, "{0} {1} {2}\n", MaxBufs, r.syscalls_per_flush, (uint64_t)r.ns_per_flush);
+}
+
+int main(int argc, char **argv)
+{
+	size_t const n_bufs   = (argc > 1) ? atoi(argv[1]) : 200;
+	size_t const buf_size = (argc > 2) ? atoi(argv[2]) : 64;
+	size_t const flushes  = (argc > 3) ? atoi(argv[3]) : 20000;
+
+	evloop_default_t loop = libev::create_default_loop(EVFLAG_AUTO | EVFLAG_NOENV);
+
+	ff::fmt(stdout, "n_bufs: {0}, buf_size: {1}, flushes: {2}\n", n_bufs, buf_size, flushes);
+	ff::fmt(stdout, "{0} {1} {2}\n", "max_bufs", "syscalls/flush", "ns/flush");
+
+	run_and_print<8>(get_handle(loop), n_bufs, buf_size, flushes);
+	run_and_print<64>(get_handle(loop), n_bufs, buf_size, flushes);
+	run_and_print<IOV_MAX>(get_handle(loop), n_bufs, buf_size, flushes);
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+////////////////////////////////////////////////////////////////////////////////////////////////
+// vim: set filetype=cpp autoindent noexpandtab tabstop=4 shiftwidth=4 foldmethod=marker :
+// (c) Anton Povarov <anton.povarov@gmail.com>
+////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// cd meow/test/libev/
+// g++ -std=c++11 -O2 -I ~/_Dev/meow/ -o zerocopy_send_perf zerocopy_send_perf.cpp -lev -pthread
+//
+// ./zerocopy_send_perf [mb_per_run = 2048]
+//
+// bulk send over tcp loopback, plain writev() vs sendmsg(MSG_ZEROCOPY), for a range of buffer sizes
+//  the reader is a separate thread doing blocking reads into a 1mb buffer
+//  buffers come from the pool, so zerocopy ones get reused only after completion
+//
+// NOTE: over loopback the kernel copies zerocopy data on delivery anyway ('copied' column)
+//       so this shows the overhead side of the crossover, real nics are where the gains are
+//
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <meow/buffer_pool.hpp>
+#include <meow/format/format.hpp>
+#include <meow/format/sink/FILE.hpp>
+#include <meow/stopwatch.hpp>
+
+#include <meow/libev/libev.hpp>
+#include <meow/libev/detail/generic_connection_impl.hpp>
+
+namespace ff = meow::format;
+namespace libev = meow::libev;
+using namespace libev;
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct sink_connection_t;
+
+struct sink_events_t
+{
+	void on_closed(sink_connection_t *c, io_close_report_t const&) {}
+};
+
+struct sink_connection_t : public generic_connection_e_t<sink_events_t>
+{
+};
+
+struct read_nothing_traits
+{
+	struct read
+	{
+		struct context_t {};
+
+		template<class ContextT>
+		static meow::buffer_ref get_buffer(ContextT *ctx) { return meow::buffer_ref(); }
+
+		template<class ContextT>
+		static rd_consume_status_t consume_buffer(ContextT*, meow::buffer_ref, read_status_t) { return rd_consume_status::loop_break; }
+	};
+};
+
+struct copy_traits : public read_nothing_traits
+{
+};
+
+struct zerocopy_traits : public read_nothing_traits
+{
+	struct option_write_zerocopy_threshold { enum { value = 1 }; }; // every send, the benchmark picks buffer sizes
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct run_ctx_t
+{
+	evloop_t           *loop;
+	sink_connection_t  *conn;
+	size_t              buf_size;
+	uint64_t            total;
+	uint64_t            queued;
+	ev_check            check;
+	ev_async            done;
+};
+
+static void top_up_cb(struct ev_loop*, ev_check *w, int)
+{
+	run_ctx_t *r = (run_ctx_t*)w->data;
+	uint64_t const window = 8 * 1024 * 1024;
+
+	// write right here, a fed event would wait for the next poll, and nothing might wake us up
+	//  when all the data got written without EAGAIN
+	do
+	{
+		while (r->queued < r->total && (r->queued - r->conn->io_stats.bytes_written) < window)
+		{
+			meow::buffer_move_ptr b = meow::create_buffer_from_pool(r->buf_size);
+			b->advance_last(r->buf_size);
+			r->conn->queue_buf(move(b));
+			r->queued += r->buf_size;
+		}
+
+		r->conn->run_loop(EV_WRITE);
+	}
+	while (r->queued < r->total && r->conn->wchain_ref().empty());
+}
+
+static void done_cb(struct ev_loop *loop, ev_async*, int)
+{
+	ev_break(loop, EVBREAK_ALL);
+}
+
+template<class Traits>
+static double run(evloop_t *loop, size_t buf_size, uint64_t total, generic_connection_zerocopy_context_t::zc_stats_t *zc_stats)
+{
+	int ls = ::socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sa = {};
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t sa_len = sizeof(sa);
+	::bind(ls, (struct sockaddr*)&sa, sizeof(sa));
+	::listen(ls, 1);
+	::getsockname(ls, (struct sockaddr*)&sa, &sa_len);
+
+	run_ctx_t r = {};
+	r.loop = loop;
+	r.buf_size = buf_size;
+	r.total = total - (total % buf_size);
+
+	ev_async_init(&r.done, done_cb);
+	ev_async_start(loop, &r.done);
+
+	std::thread reader([&]()
+	{
+		int s = ::socket(AF_INET, SOCK_STREAM, 0);
+		::connect(s, (struct sockaddr*)&sa, sizeof(sa));
+
+		std::vector<char> buf(1024 * 1024);
+		uint64_t got = 0;
+		while (got < r.total)
+		{
+			ssize_t n = ::read(s, buf.data(), buf.size());
+			if (n <= 0)
+				break;
+			got += n;
+		}
+
+		ev_async_send(loop, &r.done);
+		::close(s);
+	});
+
+	int fd = ::accept(ls, NULL, NULL);
+	::close(ls);
+
+	sink_events_t ev;
+	typedef generic_connection_impl_t<sink_connection_t, Traits> conn_t;
+	conn_t *c = new conn_t(loop, fd, &ev);
+	r.conn = c;
+
+	ev_check_init(&r.check, top_up_cb);
+	r.check.data = &r;
+	ev_check_start(loop, &r.check);
+
+	meow::stopwatch_t sw;
+	top_up_cb(loop, &r.check, EV_CHECK);
+	libev::run_loop(loop);
+	double const elapsed = timeval_to_double(sw.stamp());
+
+	reader.join();
+
+	ev_check_stop(loop, &r.check);
+	ev_async_stop(loop, &r.done);
+
+	zerocopy_stats(c, zc_stats);
+
+	delete c;
+	::close(fd);
+
+	return (r.total / elapsed) / (1024 * 1024);
+}
+
+template<class C>
+static void zerocopy_stats(C *c, generic_connection_zerocopy_context_t::zc_stats_t *st)
+{
+	zerocopy_stats_impl(c, st, std::is_base_of<generic_connection_zerocopy_context_t, C>());
+}
+
+template<class C>
+static void zerocopy_stats_impl(C *c, generic_connection_zerocopy_context_t::zc_stats_t *st, std::true_type) { *st = c->zc_stats; }
+
+template<class C>
+static void zerocopy_stats_impl(C *c, generic_connection_zerocopy_context_t::zc_stats_t *st, std::false_type) {}
+
+int main(int argc, char **argv)
+{
+	uint64_t const total = uint64_t((argc > 1) ? atoi(argv[1]) : 2048) * 1024 * 1024;
+
+	evloop_default_t loop = libev::create_default_loop(EVFLAG_AUTO | EVFLAG_NOENV);
+
+	ff::fmt(stdout, "{0} {1} {2} {3} {4}\n", "buf_size", "copy_mb/s", "zerocopy_mb/s", "zc_sends", "zc_copied");
+
+	size_t crossover = 0;
+	for (size_t sz = 4 * 1024; sz <= 4 * 1024 * 1024; sz *= 2)
+	{
+		generic_connection_zerocopy_context_t::zc_stats_t st = {};
+
+		double const copy_mbs = run<copy_traits>(get_handle(loop), sz, total, &st);
+		double const zc_mbs   = run<zerocopy_traits>(get_handle(loop), sz, total, &st);
+
+		ff::fmt(stdout, "{0} {1} {2} {3} {4}\n", sz, (uint64_t)copy_mbs, (uint64_t)zc_mbs, st.sends, st.copied);
+
+		if (!crossover && zc_mbs > copy_mbs)
+			crossover = sz;
+	}
+
+	if (crossover)
+		ff::fmt(stdout, "zerocopy is faster from {0} byte buffers\n", crossover);
+	else
+		ff::fmt(stdout, "zerocopy never wins here\n");
+
+	return 0;
+}